@@ -9,7 +9,7 @@ int main() {
 
     auto my_variable = GlobalVariable::create("msg",
             *Type::Array(Type::Integer(8), 13),
-            Constant::String("Hello World!\\00"))
+            Constant::String(std::string("Hello World!", 13)))
                     .set_linkage(Linkage::Internal);
     auto puts = ExternalFunction::create("puts", *Type::Integer())
             .add_parameter(FunctionParameter{*Type::Pointer(Type::Integer(8))});
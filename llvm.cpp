@@ -1,7 +1,18 @@
 #include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "llvm.hpp"
 
 namespace LLVM {
@@ -41,9 +52,13 @@ template <> std::string generate<PreemptionSpecifier>([[maybe_unused]] Preemptio
     return ss.str();
 }
 
-template <> std::string generate<Visibility>([[maybe_unused]] Visibility visibility) {
-    std::stringstream ss;
-    return ss.str();
+template <> std::string generate<Visibility>(Visibility visibility) {
+    switch (visibility) {
+        case Visibility::Default: return "default";
+        case Visibility::Hidden: return "hidden";
+        case Visibility::Protected: return "protected";
+    }
+    std::unreachable();
 }
 
 template <> std::string generate<DLLStorageClass>(DLLStorageClass storage_class) {
@@ -96,28 +111,274 @@ template <> std::string generate<CallingConvention>(CallingConvention cc) {
 template <> std::string generate<Type>(Type type) {
     std::stringstream ss;
     switch (type.kind) {
+        case Type::Kind::Void: ss << "void"; break;
         case Type::Kind::Integer: ss << "i" << type.size; break;
+        case Type::Kind::Half: ss << "half"; break;
+        case Type::Kind::BFloat: ss << "bfloat"; break;
+        case Type::Kind::Float: ss << "float"; break;
+        case Type::Kind::Double: ss << "double"; break;
+        case Type::Kind::fp128: ss << "fp128"; break;
+        case Type::Kind::x86_fp80: ss << "x86_fp80"; break;
+        case Type::Kind::ppc_fp128: ss << "ppc_fp128"; break;
         case Type::Kind::Pointer: ss << generate<Type>(*type.inner) << "*"; break;
+        case Type::Kind::Vector: ss << "<" << type.size << " x " << generate<Type>(*type.inner) << ">"; break;
+        case Type::Kind::Label: ss << "label"; break;
         case Type::Kind::Array: ss << "[" << type.size << " x " << generate<Type>(*type.inner) << "]"; break;
+        case Type::Kind::Structure: {
+            ss << "{";
+            for (int i = 0; i < type.members.size(); i++) {
+                ss << " " << generate<Type>(type.members.at(i));
+                if (i < type.members.size() - 1)
+                    ss << ",";
+            }
+            ss << (type.members.empty() ? "}" : " }");
+        } break;
         default: PANIC("TODO!", "");
     }
     return ss.str();
 }
 
+static bool printable_in_c_string(unsigned char c) {
+    return c >= 0x20 && c < 0x7f && c != '"' && c != '\\';
+}
+
+// Length of the leading run of bytes that can be copied into a c"..."
+// string verbatim, scanning 16 bytes at a time where SSE2 is available.
+static usz printable_run(const char *bytes, usz size) {
+    usz i = 0;
+#if defined(__SSE2__)
+    // Signed compares: bytes >= 0x80 are negative and fail the lower bound.
+    const __m128i low = _mm_set1_epi8(0x1f), high = _mm_set1_epi8(0x7f);
+    const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i));
+        __m128i in_range = _mm_and_si128(_mm_cmpgt_epi8(chunk, low), _mm_cmplt_epi8(chunk, high));
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+        auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_andnot_si128(special, in_range)));
+        if (mask != 0xffff)
+            return i + std::countr_one(mask);
+    }
+#endif
+    while (i < size && printable_in_c_string(static_cast<unsigned char>(bytes[i]))) i++;
+    return i;
+}
+
+// Appends `bytes` with everything but printable runs escaped as `\XX`, the
+// form both c"..." strings and metadata strings use.
+static void escape_bytes(std::string& out, const char *bytes, usz size) {
+    static constexpr char hex[] = "0123456789ABCDEF";
+    for (usz i = 0; i < size;) {
+        usz run = printable_run(bytes + i, size - i);
+        out.append(bytes + i, run);
+        i += run;
+        if (i == size) break;
+        auto c = static_cast<unsigned char>(bytes[i++]);
+        char escaped[] = {'\\', hex[c >> 4], hex[c & 0xf]};
+        out.append(escaped, sizeof(escaped));
+    }
+}
+
+static void write_c_string(std::ostream& os, const char *bytes, usz size) {
+    std::string out;
+    out.reserve(size + 3);
+    out += "c\"";
+    escape_bytes(out, bytes, size);
+    out += '"';
+    os.write(out.data(), static_cast<std::streamsize>(out.size()));
+}
+
+template <typename T> static T load_element(const char *bytes, usz index) {
+    T value;
+    std::memcpy(&value, bytes + index * sizeof(T), sizeof(T));
+    return value;
+}
+
+// Bits of the double equal to the float with bits `bits`. Built from the
+// fields rather than by converting, which quiets signaling NaNs on x86;
+// NaN payloads move to the top of the double's mantissa, where LLVM expects
+// a float's.
+static std::uint64_t widened_float_bits(std::uint32_t bits) {
+    std::uint64_t sign = static_cast<std::uint64_t>(bits >> 31) << 63;
+    int exponent = static_cast<int>((bits >> 23) & 0xff);
+    std::uint32_t mantissa = bits & 0x7fffff;
+    if (exponent == 0xff) return sign | (0x7ffull << 52) | (static_cast<std::uint64_t>(mantissa) << 29);
+    if (exponent == 0) {
+        if (mantissa == 0) return sign;
+        // Subnormal: normalize, since every float is a normal double.
+        int shift = std::countl_zero(mantissa) - 8;
+        mantissa = (mantissa << shift) & 0x7fffff;
+        exponent = 1 - shift;
+    }
+    return sign | (static_cast<std::uint64_t>(exponent - 127 + 1023) << 52) | (static_cast<std::uint64_t>(mantissa) << 29);
+}
+
+// Formats `[<ty> v0, <ty> v1, ...]` through a fixed buffer. Floating point
+// values use LLVM's exact hexadecimal double form.
+static void write_data(std::ostream& os, const ConstantData& data) {
+    const char *bytes = data.bytes.data();
+    if (std::all_of(data.bytes.begin(), data.bytes.end(), [](char c) { return c == 0; })) {
+        os << "zeroinitializer";
+        return;
+    }
+
+    const char *type = "";
+    switch (data.element) {
+        case ConstantData::Element::I8:
+            // At most 3 characters per byte, against at least 6 for `i8 0, `.
+            write_c_string(os, bytes, data.count);
+            return;
+        case ConstantData::Element::I16: type = "i16 "; break;
+        case ConstantData::Element::I32: type = "i32 "; break;
+        case ConstantData::Element::I64: type = "i64 "; break;
+        case ConstantData::Element::Float: type = "float "; break;
+        case ConstantData::Element::Double: type = "double "; break;
+    }
+    usz type_size = std::strlen(type);
+
+    char buffer[1 << 16];
+    usz used = 0;
+    buffer[used++] = '[';
+    for (usz i = 0; i < data.count; i++) {
+        // Longest element: "double 0x" + 16 digits + ", "
+        if (sizeof(buffer) - used < 32) {
+            os.write(buffer, static_cast<std::streamsize>(used));
+            used = 0;
+        }
+        if (i > 0) {
+            buffer[used++] = ',';
+            buffer[used++] = ' ';
+        }
+        std::memcpy(buffer + used, type, type_size);
+        used += type_size;
+
+        char *first = buffer + used, *last = buffer + sizeof(buffer);
+        switch (data.element) {
+            case ConstantData::Element::I8: break; // written as c"..." above
+            case ConstantData::Element::I16: first = std::to_chars(first, last, load_element<std::int16_t>(bytes, i)).ptr; break;
+            case ConstantData::Element::I32: first = std::to_chars(first, last, load_element<std::int32_t>(bytes, i)).ptr; break;
+            case ConstantData::Element::I64: first = std::to_chars(first, last, load_element<std::int64_t>(bytes, i)).ptr; break;
+            case ConstantData::Element::Float:
+            case ConstantData::Element::Double: {
+                auto bits = data.element == ConstantData::Element::Float
+                        ? widened_float_bits(load_element<std::uint32_t>(bytes, i))
+                        : load_element<std::uint64_t>(bytes, i);
+                *first++ = '0';
+                *first++ = 'x';
+                for (int shift = 60; shift >= 0; shift -= 4)
+                    *first++ = "0123456789ABCDEF"[(bits >> shift) & 0xf];
+            } break;
+        }
+        used = first - buffer;
+    }
+    buffer[used++] = ']';
+    os.write(buffer, static_cast<std::streamsize>(used));
+}
+
 template <> std::string generate<Constant>(Constant constant) {
     std::stringstream ss;
     switch (constant.type) {
-        case Constant::Type::Boolean: ss << constant.bool_value; break;
+        case Constant::Type::Boolean: ss << (constant.bool_value ? "true" : "false"); break;
         case Constant::Type::Integer: ss << constant.int_value; break;
         case Constant::Type::Float: ss << constant.float_value; break;
-        case Constant::Type::String: ss << "c\"" << constant.string_value << "\""; break;
-        case Constant::Type::LocalVariable: ss << "%" << constant.variable_name; break;
-        case Constant::Type::GlobalVariable: ss << "@" << constant.variable_name; break;
+        case Constant::Type::String: write_c_string(ss, constant.string_value->data(), constant.string_value->size()); break;
+        case Constant::Type::LocalVariable: ss << "%" << *constant.variable_name; break;
+        case Constant::Type::GlobalVariable: ss << "@" << *constant.variable_name; break;
+        case Constant::Type::Null: ss << "null"; break;
+        case Constant::Type::ZeroInitializer: ss << "zeroinitializer"; break;
+        case Constant::Type::Array:
+        case Constant::Type::Struct:
+        case Constant::Type::Vector: {
+            const char *open = constant.type == Constant::Type::Array ? "[" : constant.type == Constant::Type::Struct ? "{ " : "<";
+            const char *close = constant.type == Constant::Type::Array ? "]" : constant.type == Constant::Type::Struct ? " }" : ">";
+            ss << open;
+            for (int i = 0; i < constant.elements->size(); i++) {
+                const auto& element = constant.elements->at(i);
+                ss << generate<Type>(element.type) << " " << generate<Constant>(element.value);
+                if (i < constant.elements->size() - 1)
+                    ss << ", ";
+            }
+            ss << close;
+        } break;
+        case Constant::Type::Data: write_data(ss, *constant.data); break;
         default: PANIC("TODO!", "");
     }
     return ss.str();
 }
 
+std::string MetadataTable::string(const std::string& value) {
+    std::string out = "!\"";
+    escape_bytes(out, value.data(), value.size());
+    out += '"';
+    return out;
+}
+
+std::string MetadataTable::value(::LLVM::Type type, Constant constant) {
+    return generate<Type>(type) + " " + generate<Constant>(constant);
+}
+
+usz MetadataTable::node(const Vec<std::string>& operands) {
+    std::stringstream ss;
+    ss << "!{";
+    for (int i = 0; i < operands.size(); i++) {
+        ss << operands.at(i);
+        if (i < operands.size() - 1)
+            ss << ", ";
+    }
+    ss << "}";
+    auto [it, inserted] = this->ids.try_emplace(ss.str(), this->nodes.size());
+    if (inserted) {
+        this->nodes.push_back(it->first);
+        this->operands.push_back(operands);
+    }
+    return it->second;
+}
+
+usz MetadataTable::distinct_self_node(const Vec<std::string>& operands) {
+    usz id = this->nodes.size();
+    std::stringstream ss;
+    ss << "distinct !{" << reference(id);
+    for (const auto& operand : operands)
+        ss << ", " << operand;
+    ss << "}";
+    this->nodes.push_back(ss.str());
+    this->operands.push_back(operands);
+    return id;
+}
+
+usz MetadataTable::branch_weights(const Vec<usz>& weights) {
+    // Weights are i32; larger ones (e.g. raw profile counts) are divided down
+    // by a common factor, as LLVM does, which keeps their ratios.
+    usz largest = weights.empty() ? 0 : *std::max_element(weights.begin(), weights.end());
+    usz scale = largest > UINT32_MAX ? largest / UINT32_MAX + 1 : 1;
+    Vec<std::string> operands{string("branch_weights")};
+    for (auto weight : weights)
+        operands.push_back(value(*Type::Integer(32), Constant::Integer(static_cast<long long>(weight / scale))));
+    return this->node(operands);
+}
+
+usz MetadataTable::function_entry_count(usz count) {
+    return this->node({string("function_entry_count"),
+                       value(*Type::Integer(64), Constant::Integer(static_cast<long long>(count)))});
+}
+
+usz MetadataTable::loop_property(const std::string& name, usz v) {
+    return this->node({string(name), value(*Type::Integer(32), Constant::Integer(static_cast<long long>(v)))});
+}
+
+template <> std::string generate<MetadataTable>(MetadataTable table) {
+    std::stringstream ss;
+    for (int i = 0; i < table.nodes.size(); i++)
+        ss << "!" << i << " = " << table.nodes.at(i) << "\n";
+    return ss.str();
+}
+
+static std::string generate_attachments(const Vec<MetadataAttachment>& attachments, const char *separator) {
+    std::stringstream ss;
+    for (const auto& attachment : attachments)
+        ss << separator << "!" << attachment.kind << " !" << attachment.node;
+    return ss.str();
+}
+
 template <> std::string generate<Instruction>(Instruction inst) {
     std::stringstream ss;
     if (inst.name.has_value())
@@ -129,6 +390,40 @@ template <> std::string generate<Instruction>(Instruction inst) {
             if (ret.value.has_value())
                 ss << " " << generate<Constant>(ret.value.value());
         } break;
+        case Instruction::Type::Br: {
+            auto br = *std::get<InstructionDetails::Br *>(inst.var);
+            ss << "br ";
+            if (br.condition.has_value())
+                ss << "i1 " << generate<Constant>(br.condition.value()) << ", ";
+            ss << "label %" << br.if_true;
+            if (br.if_false.has_value()) ss << ", label %" << br.if_false.value();
+        } break;
+        case Instruction::Type::Switch: {
+            auto sw = *std::get<InstructionDetails::Switch *>(inst.var);
+            auto type = generate<Type>(sw.type);
+            ss << "switch " << type << " " << generate<Constant>(sw.value);
+            ss << ", label %" << sw.default_destination << " [";
+            for (const auto& c : sw.cases)
+                ss << " " << type << " " << generate<Constant>(c.value) << ", label %" << c.destination;
+            ss << " ]";
+        } break;
+        case Instruction::Type::Phi: {
+            auto phi = *std::get<InstructionDetails::Phi *>(inst.var);
+            ss << "phi " << generate<Type>(phi.type) << " ";
+            for (int i = 0; i < phi.incoming.size(); i++) {
+                auto incoming = phi.incoming.at(i);
+                ss << "[ " << generate<Constant>(incoming.value) << ", %" << incoming.block << " ]";
+                if (i < phi.incoming.size() - 1)
+                    ss << ", ";
+            }
+        } break;
+        case Instruction::Type::Select: {
+            auto select = *std::get<InstructionDetails::Select *>(inst.var);
+            auto type = generate<Type>(select.type);
+            ss << "select " << generate<Type>(select.condition_type) << " " << generate<Constant>(select.condition);
+            ss << ", " << type << " " << generate<Constant>(select.true_value);
+            ss << ", " << type << " " << generate<Constant>(select.false_value);
+        } break;
         case Instruction::Type::Alloca: {
             auto alloca = *std::get<InstructionDetails::Alloca *>(inst.var);
             ss << "alloca ";
@@ -177,6 +472,7 @@ template <> std::string generate<Instruction>(Instruction inst) {
         } break;
         default: PANIC("TODO!", "");
     }
+    ss << generate_attachments(inst.metadata, ", ");
     return ss.str();
 }
 
@@ -196,6 +492,262 @@ template <> std::string generate<BasicBlock>(BasicBlock bb) {
     return ss.str();
 }
 
+usz ControlFlowGraph::node(const std::string& name) {
+    auto [it, inserted] = this->indices.try_emplace(name, this->nodes.size());
+    if (inserted) this->nodes.push_back(Node{.name = name});
+    return it->second;
+}
+
+void ControlFlowGraph::add_edge(usz from, usz to) {
+    // Like LLVM, several switch cases targeting the same block are separate
+    // edges, and a phi needs one entry for each of them.
+    this->nodes.at(from).successors.push_back(to);
+    this->nodes.at(to).predecessors.push_back(from);
+}
+
+static bool is_terminator(Instruction::Type type) {
+    switch (type) {
+        case Instruction::Type::Ret: case Instruction::Type::Br: case Instruction::Type::Switch:
+        case Instruction::Type::IndirectBr: case Instruction::Type::Invoke: case Instruction::Type::Callbr:
+        case Instruction::Type::Resume: case Instruction::Type::Catchswitch: case Instruction::Type::Catchret:
+        case Instruction::Type::Cleanupret: case Instruction::Type::Unreachable:
+            return true;
+        default: return false;
+    }
+}
+
+static const void *instruction_identity(const Instruction& inst) {
+    return std::visit([](auto *details) -> const void * { return details; }, inst.var);
+}
+
+void ControlFlowGraph::fold(usz node, const BasicBlock& bb) {
+    for (usz succ : this->nodes.at(node).successors) {
+        auto& predecessors = this->nodes.at(succ).predecessors;
+        predecessors.erase(std::find(predecessors.begin(), predecessors.end(), node));
+    }
+    this->nodes.at(node).successors.clear();
+    this->nodes.at(node).folded_size = bb.instructions.size();
+    this->nodes.at(node).folded_terminator = bb.instructions.empty() ? nullptr : instruction_identity(bb.instructions.back());
+    this->dominators_valid = false;
+
+    if (bb.instructions.empty()) return;
+    const auto& terminator = bb.instructions.back();
+    switch (terminator.type) {
+        case Instruction::Type::Br: {
+            auto br = *std::get<InstructionDetails::Br *>(terminator.var);
+            this->add_edge(node, this->node(br.if_true));
+            if (br.if_false.has_value()) this->add_edge(node, this->node(br.if_false.value()));
+        } break;
+        case Instruction::Type::Switch: {
+            auto sw = *std::get<InstructionDetails::Switch *>(terminator.var);
+            this->add_edge(node, this->node(sw.default_destination));
+            for (const auto& c : sw.cases)
+                this->add_edge(node, this->node(c.destination));
+        } break;
+        default: break;
+    }
+}
+
+void ControlFlowGraph::sync(const Vec<BasicBlock>& body) {
+    for (; this->synced < body.size(); this->synced++) {
+        const auto& bb = body.at(this->synced);
+        usz node = this->node(bb.name);
+        if (this->nodes.at(node).defined)
+            PANIC("basic block '%s' defined twice", bb.name.c_str());
+        this->nodes.at(node).defined = true;
+        this->nodes.at(node).block = this->synced;
+        this->fold(node, bb);
+    }
+}
+
+void ControlFlowGraph::refresh(const Vec<BasicBlock>& body) {
+    this->sync(body);
+    // Folding may add placeholder nodes, which are never defined.
+    for (usz node = 0; node < this->nodes.size(); node++) {
+        if (!this->nodes[node].defined) continue;
+        const auto& bb = body.at(this->nodes[node].block);
+        const void *terminator = bb.instructions.empty() ? nullptr : instruction_identity(bb.instructions.back());
+        if (bb.instructions.size() != this->nodes[node].folded_size || terminator != this->nodes[node].folded_terminator)
+            this->fold(node, bb);
+    }
+}
+
+void ControlFlowGraph::compute_dominators() {
+    usz n = this->nodes.size();
+    this->idom.assign(n, npos);
+    this->dom_pre.assign(n, npos);
+    this->dom_post.assign(n, npos);
+    this->dominators_valid = true;
+    if (n == 0) return;
+
+    // Reverse postorder over the blocks reachable from the entry.
+    Vec<usz> postorder_number(n, npos), order;
+    Vec<bool> visited(n, false);
+    Vec<std::pair<usz, usz>> stack{{0, 0}};
+    visited[0] = true;
+    while (!stack.empty()) {
+        auto& [block, next] = stack.back();
+        const auto& successors = this->nodes.at(block).successors;
+        if (next < successors.size()) {
+            usz succ = successors.at(next++);
+            if (!visited[succ]) {
+                visited[succ] = true;
+                stack.emplace_back(succ, 0);
+            }
+        } else {
+            postorder_number[block] = order.size();
+            order.push_back(block);
+            stack.pop_back();
+        }
+    }
+    std::reverse(order.begin(), order.end());
+
+    auto intersect = [&](usz a, usz b) {
+        while (a != b) {
+            while (postorder_number[a] < postorder_number[b]) a = this->idom[a];
+            while (postorder_number[b] < postorder_number[a]) b = this->idom[b];
+        }
+        return a;
+    };
+
+    this->idom[0] = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (usz block : order) {
+            if (block == 0) continue;
+            usz new_idom = npos;
+            for (usz pred : this->nodes.at(block).predecessors) {
+                if (this->idom[pred] == npos) continue;
+                new_idom = new_idom == npos ? pred : intersect(pred, new_idom);
+            }
+            if (new_idom != this->idom[block]) {
+                this->idom[block] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    // Number the dominator tree so that `dominates` is an interval check.
+    Vec<Vec<usz>> children(n);
+    for (usz block : order)
+        if (block != 0) children[this->idom[block]].push_back(block);
+    usz clock = 0;
+    stack = {{0, 0}};
+    this->dom_pre[0] = clock++;
+    while (!stack.empty()) {
+        auto& [block, next] = stack.back();
+        if (next < children[block].size()) {
+            usz child = children[block][next++];
+            this->dom_pre[child] = clock++;
+            stack.emplace_back(child, 0);
+        } else {
+            this->dom_post[block] = clock++;
+            stack.pop_back();
+        }
+    }
+    this->idom[0] = npos;
+}
+
+Opt<usz> ControlFlowGraph::immediate_dominator(usz block) {
+    if (!this->dominators_valid) this->compute_dominators();
+    usz dom = this->idom.at(block);
+    if (dom == npos) return None;
+    return dom;
+}
+
+bool ControlFlowGraph::dominates(usz a, usz b) {
+    if (!this->dominators_valid) this->compute_dominators();
+    if (this->dom_pre.at(a) == npos || this->dom_pre.at(b) == npos) return false;
+    return this->dom_pre[a] <= this->dom_pre[b] && this->dom_post[b] <= this->dom_post[a];
+}
+
+Function& Function::add_instruction(const std::string& block, const Instruction& instruction) & {
+    this->cfg.sync(this->body);
+    auto node = this->cfg.index_of(block);
+    if (!node.has_value() || !this->cfg.nodes.at(node.value()).defined)
+        PANIC("no basic block '%s' in @%s", block.c_str(), this->function_name.c_str());
+    auto& bb = this->body.at(this->cfg.nodes.at(node.value()).block);
+    if (!bb.instructions.empty() && is_terminator(bb.instructions.back().type))
+        PANIC("'%s' in @%s already ends in a terminator", block.c_str(), this->function_name.c_str());
+    bb.instructions.push_back(instruction);
+    this->cfg.fold(node.value(), bb);
+    return *this;
+}
+
+void Function::verify() {
+    this->cfg.refresh(this->body);
+    for (const auto& node : this->cfg.nodes)
+        if (!node.defined)
+            PANIC("branch to undefined block '%s' in @%s", node.name.c_str(), this->function_name.c_str());
+
+    for (const auto& bb : this->body) {
+        const auto& predecessors = this->cfg.predecessors(this->cfg.index_of(bb.name).value());
+        Vec<usz> expected(predecessors.begin(), predecessors.end());
+        std::sort(expected.begin(), expected.end());
+
+        bool past_phis = false;
+        for (usz i = 0; i < bb.instructions.size(); i++) {
+            const auto& inst = bb.instructions[i];
+            if (is_terminator(inst.type) && i + 1 < bb.instructions.size())
+                PANIC("terminator before the end of '%s' in @%s", bb.name.c_str(), this->function_name.c_str());
+            if (inst.type != Instruction::Type::Phi) {
+                past_phis = true;
+                continue;
+            }
+            if (past_phis)
+                PANIC("phi after other instructions in '%s' in @%s", bb.name.c_str(), this->function_name.c_str());
+            Vec<std::pair<usz, std::string>> incoming;
+            for (const auto& in : std::get<InstructionDetails::Phi *>(inst.var)->incoming) {
+                auto index = this->cfg.index_of(in.block);
+                if (!index.has_value())
+                    PANIC("phi in '%s' references unknown block '%s'", bb.name.c_str(), in.block.c_str());
+                incoming.emplace_back(index.value(), generate<Constant>(in.value));
+            }
+            std::sort(incoming.begin(), incoming.end());
+            Vec<usz> blocks;
+            for (usz i = 0; i < incoming.size(); i++) {
+                // One entry per edge, so a block reached by several edges
+                // appears several times, always with the same value.
+                if (i > 0 && incoming[i].first == incoming[i - 1].first && incoming[i].second != incoming[i - 1].second)
+                    PANIC("phi in '%s' has different values for predecessor '%s'",
+                          bb.name.c_str(), this->cfg.nodes.at(incoming[i].first).name.c_str());
+                blocks.push_back(incoming[i].first);
+            }
+            if (blocks != expected)
+                PANIC("phi incoming blocks in '%s' don't match its predecessors", bb.name.c_str());
+        }
+    }
+}
+
+void Function::verify(const MetadataTable& metadata) {
+    this->verify();
+    for (const auto& bb : this->body)
+        for (const auto& inst : bb.instructions)
+            for (const auto& attachment : inst.metadata) {
+                if (attachment.kind != "prof") continue;
+                if (attachment.node >= metadata.operands.size())
+                    PANIC("!prof in '%s' refers to unknown node !%lu", bb.name.c_str(), attachment.node);
+                const auto& operands = metadata.operands.at(attachment.node);
+                if (operands.empty() || operands.front() != MetadataTable::string("branch_weights")) continue;
+
+                // One weight per successor, as the LLVM verifier requires.
+                usz successors = 0;
+                switch (inst.type) {
+                    case Instruction::Type::Br:
+                        successors = std::get<InstructionDetails::Br *>(inst.var)->if_false.has_value() ? 2 : 1;
+                        break;
+                    case Instruction::Type::Switch:
+                        successors = std::get<InstructionDetails::Switch *>(inst.var)->cases.size() + 1;
+                        break;
+                    case Instruction::Type::Select: successors = 2; break;
+                    case Instruction::Type::Call: successors = 1; break;
+                    default: PANIC("branch weights on an instruction that can't have them in '%s'", bb.name.c_str());
+                }
+                if (operands.size() - 1 != successors)
+                    PANIC("%lu branch weights for %lu successors in '%s'", operands.size() - 1, successors, bb.name.c_str());
+            }
+}
+
 template <> std::string generate<GlobalVariable>(GlobalVariable var) {
     std::stringstream ss;
     ss << "@" << var.global_var_name << " = ";
@@ -221,6 +773,7 @@ template <> std::string generate<GlobalVariable>(GlobalVariable var) {
     if (var.no_sanitize_hwaddress) ss << ", no_sanitize_hwaddress";
     if (var.sanitize_address_dyninit) ss << ", sanitize_address_dyninit";
     if (var.sanitize_memtag) ss << ", sanitize_memtag";
+    ss << generate_attachments(var.metadata, ", ");
 
     ss << "\n";
 
@@ -230,6 +783,12 @@ template <> std::string generate<GlobalVariable>(GlobalVariable var) {
 template <> std::string generate<Function>(Function fn) {
     std::stringstream ss;
 
+    Arena arena; // frees a produced body once it has been written
+    if (fn.body.empty() && fn.body_producer) {
+        Arena::Scope scope(&arena);
+        fn.body = fn.body_producer();
+    }
+
     ss << "define ";
     if (fn.linkage.has_value()) ss << generate<Linkage>(fn.linkage.value()) << " ";
     if (fn.preemption_specifier.has_value())
@@ -257,6 +816,7 @@ template <> std::string generate<Function>(Function fn) {
     if (fn.section.has_value()) ss << ", section \"" << fn.section.value() << "\"";
     if (fn.partition.has_value()) ss << ", partition \"" << fn.partition.value() << "\"";
     if (fn.alignment.has_value()) ss << ", align " << fn.alignment.value();
+    ss << generate_attachments(fn.metadata, " ");
 
     ss << " {\n";
 
@@ -297,4 +857,954 @@ template <> std::string generate<ExternalFunction>(ExternalFunction fn) {
     return ss.str();
 }
 
+void Module::stream(std::ostream& os) {
+    for (const auto& var : this->global_variables)
+        os << generate<GlobalVariable>(var) << "\n";
+    for (const auto& fn : this->functions)
+        os << generate<Function>(fn) << "\n";
+    for (const auto& fn : this->external_functions)
+        os << generate<ExternalFunction>(fn) << "\n";
+    if (!this->external_functions.empty()) os << "\n";
+    os << generate<MetadataTable>(this->metadata);
+}
+
+template <> std::string generate<Module>(Module module) {
+    std::stringstream ss;
+    module.stream(ss);
+    return ss.str();
+}
+
+std::string Intrinsic::mangle(Type type) {
+    std::stringstream ss;
+    switch (type.kind) {
+        case Type::Kind::Integer: ss << "i" << type.size; break;
+        case Type::Kind::Half: ss << "f16"; break;
+        case Type::Kind::BFloat: ss << "bf16"; break;
+        case Type::Kind::Float: ss << "f32"; break;
+        case Type::Kind::Double: ss << "f64"; break;
+        case Type::Kind::fp128: ss << "f128"; break;
+        case Type::Kind::x86_fp80: ss << "f80"; break;
+        case Type::Kind::ppc_fp128: ss << "ppcf128"; break;
+        // Pointers are typed throughout this library, so they mangle as `p<addrspace><pointee>`.
+        case Type::Kind::Pointer: ss << "p0" << (type.inner ? mangle(*type.inner) : ""); break;
+        case Type::Kind::Vector: ss << "v" << type.size << mangle(*type.inner); break;
+        case Type::Kind::Array: ss << "a" << type.size << mangle(*type.inner); break;
+        default: PANIC("cannot mangle %s into an intrinsic name", generate<Type>(type).c_str());
+    }
+    return ss.str();
+}
+
+static Intrinsic memory_transfer(const char *name, Type dst, Type src, Type length) {
+    return Intrinsic{
+        .name = std::string(name) + "." + Intrinsic::mangle(dst) + "." + Intrinsic::mangle(src) + "." + Intrinsic::mangle(length),
+        .return_type = *Type::Void(),
+        .parameter_types = {dst, src, length, *Type::Integer(1)},
+    };
+}
+
+Intrinsic Intrinsic::Memcpy(Type dst, Type src, Type length) { return memory_transfer("llvm.memcpy", dst, src, length); }
+Intrinsic Intrinsic::Memmove(Type dst, Type src, Type length) { return memory_transfer("llvm.memmove", dst, src, length); }
+
+Intrinsic Intrinsic::Memset(Type dst, Type length) {
+    return Intrinsic{
+        .name = "llvm.memset." + mangle(dst) + "." + mangle(length),
+        .return_type = *Type::Void(),
+        .parameter_types = {dst, *Type::Integer(8), length, *Type::Integer(1)},
+    };
+}
+
+Intrinsic Intrinsic::Prefetch(Type address) {
+    // address, rw (0 = read, 1 = write), locality (0..3), cache type (0 = instruction, 1 = data)
+    return Intrinsic{
+        .name = "llvm.prefetch." + mangle(address),
+        .return_type = *Type::Void(),
+        .parameter_types = {address, *Type::Integer(32), *Type::Integer(32), *Type::Integer(32)},
+    };
+}
+
+Intrinsic Intrinsic::Expect(Type type) {
+    return Intrinsic{.name = "llvm.expect." + mangle(type), .return_type = type, .parameter_types = {type, type}};
+}
+
+Intrinsic Intrinsic::Assume() {
+    return Intrinsic{.name = "llvm.assume", .return_type = *Type::Void(), .parameter_types = {*Type::Integer(1)}};
+}
+
+Intrinsic Intrinsic::LifetimeStart(Type pointer) {
+    return Intrinsic{
+        .name = "llvm.lifetime.start." + mangle(pointer),
+        .return_type = *Type::Void(),
+        .parameter_types = {*Type::Integer(64), pointer},
+    };
+}
+
+Intrinsic Intrinsic::LifetimeEnd(Type pointer) {
+    return Intrinsic{
+        .name = "llvm.lifetime.end." + mangle(pointer),
+        .return_type = *Type::Void(),
+        .parameter_types = {*Type::Integer(64), pointer},
+    };
+}
+
+Intrinsic Intrinsic::Ctpop(Type type) {
+    return Intrinsic{.name = "llvm.ctpop." + mangle(type), .return_type = type, .parameter_types = {type}};
+}
+
+// The i1 operand is `is_zero_poison`.
+Intrinsic Intrinsic::Ctlz(Type type) {
+    return Intrinsic{.name = "llvm.ctlz." + mangle(type), .return_type = type, .parameter_types = {type, *Type::Integer(1)}};
+}
+
+Intrinsic Intrinsic::Cttz(Type type) {
+    return Intrinsic{.name = "llvm.cttz." + mangle(type), .return_type = type, .parameter_types = {type, *Type::Integer(1)}};
+}
+
+Intrinsic Intrinsic::Fma(Type type) {
+    return Intrinsic{.name = "llvm.fma." + mangle(type), .return_type = type, .parameter_types = {type, type, type}};
+}
+
+Intrinsic Intrinsic::VectorReduce(VectorReduction reduction, Type vector) {
+    if (vector.kind != Type::Kind::Vector)
+        PANIC("vector.reduce.%s expects a vector type, got %s",
+              generate<VectorReduction>(reduction).c_str(), generate<Type>(vector).c_str());
+    Type element = *vector.inner;
+    bool floating_reduction = reduction == VectorReduction::Fadd || reduction == VectorReduction::Fmul
+                           || reduction == VectorReduction::Fmax || reduction == VectorReduction::Fmin;
+    bool floating_element = element.kind == Type::Kind::Half || element.kind == Type::Kind::BFloat
+                         || element.kind == Type::Kind::Float || element.kind == Type::Kind::Double
+                         || element.kind == Type::Kind::fp128 || element.kind == Type::Kind::x86_fp80
+                         || element.kind == Type::Kind::ppc_fp128;
+    if (floating_reduction ? !floating_element : element.kind != Type::Kind::Integer)
+        PANIC("vector.reduce.%s expects %s elements, got %s", generate<VectorReduction>(reduction).c_str(),
+              floating_reduction ? "floating point" : "integer", generate<Type>(vector).c_str());
+    Intrinsic intrinsic{
+        .name = "llvm.vector.reduce." + generate<VectorReduction>(reduction) + "." + mangle(vector),
+        .return_type = element,
+    };
+    // The ordered floating point reductions take a start value.
+    if (reduction == VectorReduction::Fadd || reduction == VectorReduction::Fmul)
+        intrinsic.parameter_types.push_back(element);
+    intrinsic.parameter_types.push_back(vector);
+    return intrinsic;
+}
+
+// A deep copy whose pointees are never tracked by an Arena.
+static Type detached(const Type& type) {
+    Type copy = type;
+    if (type.inner) copy.inner = new Type(detached(*type.inner));
+    for (auto& member : copy.members) member = detached(member);
+    return copy;
+}
+
+InstructionDetails::Call *Module::call_intrinsic(const Intrinsic& intrinsic, const Vec<Constant>& arguments) {
+    if (this->declared_intrinsics.insert(intrinsic.name).second) {
+        auto declaration = intrinsic.declaration();
+        declaration.return_type = detached(declaration.return_type);
+        for (auto& parameter : declaration.parameters) parameter.type = detached(parameter.type);
+        this->external_functions.push_back(declaration);
+    }
+    return intrinsic.call(arguments);
+}
+
+ExternalFunction Intrinsic::declaration() const {
+    auto fn = ExternalFunction::create(this->name, this->return_type);
+    for (const auto& type : this->parameter_types)
+        fn.parameters.push_back(FunctionParameter{type});
+    return fn;
+}
+
+InstructionDetails::Call *Intrinsic::call(const Vec<Constant>& arguments) const {
+    if (arguments.size() != this->parameter_types.size())
+        PANIC("@%s expects %lu arguments, got %lu", this->name.c_str(), this->parameter_types.size(), arguments.size());
+    auto call = Instruction::Call(this->return_type, this->name);
+    for (usz i = 0; i < arguments.size(); i++)
+        call->add_argument({this->parameter_types.at(i), arguments.at(i)});
+    return call;
+}
+
+template <> std::string generate<Intrinsic::VectorReduction>(Intrinsic::VectorReduction reduction) {
+    switch (reduction) {
+        case Intrinsic::VectorReduction::Add: return "add";
+        case Intrinsic::VectorReduction::Mul: return "mul";
+        case Intrinsic::VectorReduction::And: return "and";
+        case Intrinsic::VectorReduction::Or: return "or";
+        case Intrinsic::VectorReduction::Xor: return "xor";
+        case Intrinsic::VectorReduction::Smax: return "smax";
+        case Intrinsic::VectorReduction::Smin: return "smin";
+        case Intrinsic::VectorReduction::Umax: return "umax";
+        case Intrinsic::VectorReduction::Umin: return "umin";
+        case Intrinsic::VectorReduction::Fadd: return "fadd";
+        case Intrinsic::VectorReduction::Fmul: return "fmul";
+        case Intrinsic::VectorReduction::Fmax: return "fmax";
+        case Intrinsic::VectorReduction::Fmin: return "fmin";
+    }
+    std::unreachable();
+}
+
+static bool is_local_linkage(const Opt<Linkage>& linkage) {
+    return linkage == Linkage::Private || linkage == Linkage::Internal;
+}
+
+// Calls `each` with every @name a constant refers to.
+template <typename F> static void for_each_global_reference(const Constant& constant, F each) {
+    switch (constant.type) {
+        case Constant::Type::GlobalVariable: each(*constant.variable_name); break;
+        case Constant::Type::Array:
+        case Constant::Type::Struct:
+        case Constant::Type::Vector:
+            for (const auto& element : *constant.elements)
+                for_each_global_reference(element.value, each);
+            break;
+        default: break;
+    }
+}
+
+// Calls `each` with every @name an instruction refers to.
+template <typename F> static void for_each_global_reference(const Instruction& inst, F each) {
+    auto constant = [&](const Constant& c) { for_each_global_reference(c, each); };
+    switch (inst.type) {
+        case Instruction::Type::Ret: {
+            auto ret = *std::get<InstructionDetails::Ret *>(inst.var);
+            if (ret.value.has_value()) constant(ret.value.value());
+        } break;
+        case Instruction::Type::Br: {
+            auto br = *std::get<InstructionDetails::Br *>(inst.var);
+            if (br.condition.has_value()) constant(br.condition.value());
+        } break;
+        case Instruction::Type::Switch: {
+            auto sw = *std::get<InstructionDetails::Switch *>(inst.var);
+            constant(sw.value);
+            for (const auto& c : sw.cases) constant(c.value);
+        } break;
+        case Instruction::Type::Phi:
+            for (const auto& incoming : std::get<InstructionDetails::Phi *>(inst.var)->incoming)
+                constant(incoming.value);
+            break;
+        case Instruction::Type::Select: {
+            auto select = *std::get<InstructionDetails::Select *>(inst.var);
+            constant(select.condition);
+            constant(select.true_value);
+            constant(select.false_value);
+        } break;
+        case Instruction::Type::Alloca: break;
+        case Instruction::Type::Load: constant(std::get<InstructionDetails::Load *>(inst.var)->point); break;
+        case Instruction::Type::Store: {
+            auto store = *std::get<InstructionDetails::Store *>(inst.var);
+            constant(store.value);
+            constant(store.point);
+        } break;
+        case Instruction::Type::GetElementPtr: constant(std::get<InstructionDetails::GetElementPtr *>(inst.var)->ptr_value); break;
+        case Instruction::Type::Call: {
+            auto call = *std::get<InstructionDetails::Call *>(inst.var);
+            each(call.name);
+            for (const auto& argument : call.arguments) constant(argument.value);
+        } break;
+        default: PANIC("TODO!", "");
+    }
+}
+
+// FNV-1a over a canonical encoding: integers are fed as 8 little-endian
+// bytes and strings are length-prefixed, so hashes don't depend on the host.
+struct StructuralHasher {
+    std::uint64_t state{0xcbf29ce484222325ull};
+
+    void byte(unsigned char b) {
+        this->state ^= b;
+        this->state *= 0x100000001b3ull;
+    }
+    void u64(std::uint64_t value) {
+        for (int i = 0; i < 8; i++) this->byte(static_cast<unsigned char>(value >> (8 * i)));
+    }
+    void string(const std::string& value) {
+        this->u64(value.size());
+        for (char c : value) this->byte(static_cast<unsigned char>(c));
+    }
+    template <typename E> void tag(E value) { this->u64(static_cast<std::uint64_t>(value)); }
+    template <typename T, typename F> void optional(const Opt<T>& value, F each) {
+        this->u64(value.has_value());
+        if (value.has_value()) each(value.value());
+    }
+};
+
+// Name lookup into a module whose vectors may still grow while lazy bodies
+// are produced; new entries are indexed on the first miss.
+struct SymbolIndex {
+    const Module& module;
+    std::unordered_map<std::string, usz> functions{}, external_functions{}, global_variables{};
+    usz indexed_functions{0}, indexed_external_functions{0}, indexed_global_variables{0};
+    std::unordered_map<usz, std::uint64_t> metadata_hashes{};
+
+    template <typename T, typename N>
+    static Opt<usz> find(const Vec<T>& symbols, std::unordered_map<std::string, usz>& index, usz& indexed,
+                         const std::string& name, N name_of) {
+        for (; indexed < symbols.size(); indexed++)
+            index.try_emplace(name_of(symbols.at(indexed)), indexed);
+        auto it = index.find(name);
+        if (it == index.end()) return None;
+        return it->second;
+    }
+    Opt<usz> function(const std::string& name) {
+        return find(this->module.functions, this->functions, this->indexed_functions, name,
+                    [](const Function& fn) { return fn.function_name; });
+    }
+    Opt<usz> external_function(const std::string& name) {
+        return find(this->module.external_functions, this->external_functions, this->indexed_external_functions, name,
+                    [](const ExternalFunction& fn) { return fn.function_name; });
+    }
+    Opt<usz> global_variable(const std::string& name) {
+        return find(this->module.global_variables, this->global_variables, this->indexed_global_variables, name,
+                    [](const GlobalVariable& var) { return var.global_var_name; });
+    }
+};
+
+// What a function body refers to, in order of first use.
+struct FunctionReferences {
+    Vec<std::string> functions{}, global_variables{};
+    Vec<usz> metadata{};
+    std::unordered_set<std::string> seen_functions{}, seen_global_variables{};
+
+    void function(const std::string& name) {
+        if (this->seen_functions.insert(name).second) this->functions.push_back(name);
+    }
+    void global_variable(const std::string& name) {
+        if (this->seen_global_variables.insert(name).second) this->global_variables.push_back(name);
+    }
+};
+
+static void hash_type(StructuralHasher& h, const Type& type) {
+    h.tag(type.kind);
+    h.u64(type.size);
+    h.u64(type.inner != nullptr);
+    if (type.inner) hash_type(h, *type.inner);
+    h.u64(type.members.size());
+    for (const auto& member : type.members) hash_type(h, member);
+}
+
+static usz element_size(ConstantData::Element element) {
+    switch (element) {
+        case ConstantData::Element::I8: return 1;
+        case ConstantData::Element::I16: return 2;
+        case ConstantData::Element::I32: case ConstantData::Element::Float: return 4;
+        case ConstantData::Element::I64: case ConstantData::Element::Double: return 8;
+    }
+    return 1;
+}
+
+static void hash_constant(StructuralHasher& h, const Constant& constant, FunctionReferences *references) {
+    h.tag(constant.type);
+    switch (constant.type) {
+        case Constant::Type::Boolean: h.u64(constant.bool_value); break;
+        case Constant::Type::Integer: h.u64(static_cast<std::uint64_t>(constant.int_value)); break;
+        case Constant::Type::Float: h.u64(std::bit_cast<std::uint64_t>(constant.float_value)); break;
+        case Constant::Type::String: h.string(*constant.string_value); break;
+        case Constant::Type::LocalVariable: h.string(*constant.variable_name); break;
+        case Constant::Type::GlobalVariable:
+            h.string(*constant.variable_name);
+            if (references) references->global_variable(*constant.variable_name);
+            break;
+        case Constant::Type::Null:
+        case Constant::Type::ZeroInitializer: break;
+        case Constant::Type::Array:
+        case Constant::Type::Struct:
+        case Constant::Type::Vector:
+            h.u64(constant.elements->size());
+            for (const auto& element : *constant.elements) {
+                hash_type(h, element.type);
+                hash_constant(h, element.value, references);
+            }
+            break;
+        case Constant::Type::Data: {
+            const auto& data = *constant.data;
+            h.tag(data.element);
+            h.u64(data.count);
+            // Elements are fed little-endian whatever the host order.
+            usz size = element_size(data.element);
+            if constexpr (std::endian::native == std::endian::little) {
+                for (char c : data.bytes) h.byte(static_cast<unsigned char>(c));
+            } else {
+                for (usz i = 0; i < data.bytes.size(); i += size)
+                    for (usz j = size; j-- > 0;) h.byte(static_cast<unsigned char>(data.bytes[i + j]));
+            }
+        } break;
+    }
+}
+
+static std::uint64_t hash_metadata(SymbolIndex& symbols, usz node) {
+    if (auto it = symbols.metadata_hashes.find(node); it != symbols.metadata_hashes.end()) return it->second;
+    const auto& table = symbols.module.metadata;
+    StructuralHasher h;
+    h.u64(table.nodes.at(node).starts_with("distinct"));
+    h.u64(table.operands.at(node).size());
+    // Nodes only refer to earlier ones (or, for loop IDs, to themselves,
+    // which isn't stored), so this terminates. Hash what's referenced rather
+    // than its index, which depends on emission order.
+    for (const auto& operand : table.operands.at(node)) {
+        h.u64(MetadataTable::is_reference(operand));
+        if (MetadataTable::is_reference(operand)) h.u64(hash_metadata(symbols, std::stoul(operand.substr(1))));
+        else h.string(operand);
+    }
+    symbols.metadata_hashes.emplace(node, h.state);
+    return h.state;
+}
+
+static void hash_attachments(StructuralHasher& h, SymbolIndex& symbols, const Vec<MetadataAttachment>& attachments,
+                             FunctionReferences& references) {
+    h.u64(attachments.size());
+    for (const auto& attachment : attachments) {
+        h.string(attachment.kind);
+        h.u64(hash_metadata(symbols, attachment.node));
+        references.metadata.push_back(attachment.node);
+    }
+}
+
+static void hash_instruction(StructuralHasher& h, SymbolIndex& symbols, const Instruction& inst,
+                             FunctionReferences& references) {
+    auto type = [&](const Type& t) { hash_type(h, t); };
+    auto constant = [&](const Constant& c) { hash_constant(h, c, &references); };
+    auto number = [&](usz n) { h.u64(n); };
+
+    h.tag(inst.type);
+    h.optional(inst.name, [&](const std::string& name) { h.string(name); });
+    switch (inst.type) {
+        case Instruction::Type::Ret: {
+            auto ret = *std::get<InstructionDetails::Ret *>(inst.var);
+            type(ret.type);
+            h.optional(ret.value, constant);
+        } break;
+        case Instruction::Type::Br: {
+            auto br = *std::get<InstructionDetails::Br *>(inst.var);
+            h.optional(br.condition, constant);
+            h.string(br.if_true);
+            h.optional(br.if_false, [&](const std::string& label) { h.string(label); });
+        } break;
+        case Instruction::Type::Switch: {
+            auto sw = *std::get<InstructionDetails::Switch *>(inst.var);
+            type(sw.type);
+            constant(sw.value);
+            h.string(sw.default_destination);
+            h.u64(sw.cases.size());
+            for (const auto& c : sw.cases) {
+                constant(c.value);
+                h.string(c.destination);
+            }
+        } break;
+        case Instruction::Type::Phi: {
+            auto phi = *std::get<InstructionDetails::Phi *>(inst.var);
+            type(phi.type);
+            h.u64(phi.incoming.size());
+            for (const auto& incoming : phi.incoming) {
+                constant(incoming.value);
+                h.string(incoming.block);
+            }
+        } break;
+        case Instruction::Type::Select: {
+            auto select = *std::get<InstructionDetails::Select *>(inst.var);
+            type(select.condition_type);
+            constant(select.condition);
+            type(select.type);
+            constant(select.true_value);
+            constant(select.false_value);
+        } break;
+        case Instruction::Type::Alloca: {
+            auto alloca = *std::get<InstructionDetails::Alloca *>(inst.var);
+            h.u64(alloca.inalloca);
+            type(alloca.type);
+            h.u64(alloca.elements);
+            h.optional(alloca.alignment, number);
+            h.optional(alloca.addrspace, number);
+        } break;
+        case Instruction::Type::Load: {
+            auto load = *std::get<InstructionDetails::Load *>(inst.var);
+            h.u64(load.volatile_);
+            type(load.value_type);
+            type(load.point_type);
+            constant(load.point);
+            h.optional(load.alignment, number);
+        } break;
+        case Instruction::Type::Store: {
+            auto store = *std::get<InstructionDetails::Store *>(inst.var);
+            h.u64(store.volatile_);
+            type(store.value_type);
+            constant(store.value);
+            type(store.point_type);
+            constant(store.point);
+            h.optional(store.alignment, number);
+        } break;
+        case Instruction::Type::GetElementPtr: {
+            auto gep = *std::get<InstructionDetails::GetElementPtr *>(inst.var);
+            type(gep.type);
+            type(gep.ptr_type);
+            constant(gep.ptr_value);
+        } break;
+        case Instruction::Type::Call: {
+            auto call = *std::get<InstructionDetails::Call *>(inst.var);
+            h.optional(call.tail, [&](auto tail) { h.tag(tail); });
+            h.optional(call.calling_convention, [&](auto cc) { h.tag(cc); });
+            h.optional(call.addrspace, number);
+            type(call.return_type);
+            h.string(call.name);
+            references.function(call.name);
+            h.u64(call.arguments.size());
+            for (const auto& argument : call.arguments) {
+                type(argument.type);
+                constant(argument.value);
+            }
+        } break;
+        default: PANIC("TODO!", "");
+    }
+    hash_attachments(h, symbols, inst.metadata, references);
+}
+
+static void hash_signature(StructuralHasher& h, const Opt<CallingConvention>& cc, const Type& return_type,
+                           const std::string& name, const Vec<FunctionParameter>& parameters) {
+    h.optional(cc, [&](auto c) { h.tag(c); });
+    hash_type(h, return_type);
+    h.string(name);
+    h.u64(parameters.size());
+    for (const auto& parameter : parameters) {
+        hash_type(h, parameter.type);
+        h.optional(parameter.name, [&](const std::string& n) { h.string(n); });
+    }
+}
+
+// Cache files are compiled separately and linked together, possibly with
+// other modules' files, so private and internal symbols are made external
+// there: hidden, to keep them out of the dynamic symbol table, and renamed
+// `<name>.<hash of Module::name>`, so that modules' locals don't collide.
+static std::string promoted_name(const Module& module, const std::string& name) {
+    StructuralHasher h;
+    h.string(module.name);
+    char suffix[24];
+    std::snprintf(suffix, sizeof(suffix), ".%016llx", static_cast<unsigned long long>(h.state));
+    return name + suffix;
+}
+
+// The name `name` has in cache files.
+static std::string cache_name(SymbolIndex& symbols, const std::string& name) {
+    if (auto i = symbols.function(name))
+        if (is_local_linkage(symbols.module.functions.at(i.value()).linkage)) return promoted_name(symbols.module, name);
+    if (auto i = symbols.global_variable(name))
+        if (is_local_linkage(symbols.module.global_variables.at(i.value()).linkage)) return promoted_name(symbols.module, name);
+    return name;
+}
+
+static Function promoted(const Module& module, Function fn) {
+    if (is_local_linkage(fn.linkage)) {
+        fn.function_name = promoted_name(module, fn.function_name);
+        fn.linkage = None;
+        fn.visibility = Visibility::Hidden;
+    }
+    return fn;
+}
+
+static GlobalVariable promoted(const Module& module, GlobalVariable var) {
+    if (is_local_linkage(var.linkage)) {
+        var.global_var_name = promoted_name(module, var.global_var_name);
+        var.linkage = None;
+        var.visibility = Visibility::Hidden;
+    }
+    return var;
+}
+
+static std::string declaration_of(const Module& module, const GlobalVariable& var) {
+    bool local = is_local_linkage(var.linkage);
+    std::stringstream ss;
+    ss << "@" << (local ? promoted_name(module, var.global_var_name) : var.global_var_name) << " = external ";
+    auto visibility = local ? std::make_optional(Visibility::Hidden) : var.visibility;
+    if (visibility.has_value()) ss << generate<Visibility>(visibility.value()) << " ";
+    if (var.thread_local_.has_value()) ss << generate<ThreadLocal>(var.thread_local_.value()) << " ";
+    if (var.addr_space.has_value()) ss << "addrspace(" << var.addr_space.value() << ") ";
+    ss << (var.global ? "global " : "constant ") << generate<Type>(var.type) << "\n";
+    return ss.str();
+}
+
+static ExternalFunction declaration_of(const Module& module, const Function& definition) {
+    bool local = is_local_linkage(definition.linkage);
+    auto declaration = ExternalFunction::create(
+            local ? promoted_name(module, definition.function_name) : definition.function_name, definition.return_type);
+    declaration.calling_convention = definition.calling_convention;
+    declaration.parameters = definition.parameters;
+    declaration.visibility = local ? std::make_optional(Visibility::Hidden) : definition.visibility;
+    return declaration;
+}
+
+// Copy of `constant` with every @name passed through `rename`.
+template <typename F> static Constant renamed(const Constant& constant, F rename) {
+    switch (constant.type) {
+        case Constant::Type::GlobalVariable: return Constant::GlobalVariable(rename(*constant.variable_name));
+        case Constant::Type::Array:
+        case Constant::Type::Struct:
+        case Constant::Type::Vector: {
+            auto copy = constant;
+            auto elements = Arena::track(new Vec<Constant::Element>(*constant.elements));
+            for (auto& element : *elements) element.value = renamed(element.value, rename);
+            copy.elements = elements;
+            return copy;
+        }
+        default: return constant;
+    }
+}
+
+template <typename T> static T *copied(const Instruction& inst) {
+    return Arena::track(new T(*std::get<T *>(inst.var)));
+}
+
+// Copy of `inst` with every @name passed through `rename`; the details are
+// copied rather than changed, since other blocks may share them.
+template <typename F> static Instruction renamed(const Instruction& inst, F rename) {
+    auto copy = inst;
+    auto constant = [&](Constant& c) { c = renamed(c, rename); };
+    switch (inst.type) {
+        case Instruction::Type::Ret: {
+            auto ret = copied<InstructionDetails::Ret>(inst);
+            if (ret->value.has_value()) constant(ret->value.value());
+            copy.var = ret;
+        } break;
+        case Instruction::Type::Br: {
+            auto br = copied<InstructionDetails::Br>(inst);
+            if (br->condition.has_value()) constant(br->condition.value());
+            copy.var = br;
+        } break;
+        case Instruction::Type::Switch: {
+            auto sw = copied<InstructionDetails::Switch>(inst);
+            constant(sw->value);
+            for (auto& c : sw->cases) constant(c.value);
+            copy.var = sw;
+        } break;
+        case Instruction::Type::Phi: {
+            auto phi = copied<InstructionDetails::Phi>(inst);
+            for (auto& incoming : phi->incoming) constant(incoming.value);
+            copy.var = phi;
+        } break;
+        case Instruction::Type::Select: {
+            auto select = copied<InstructionDetails::Select>(inst);
+            constant(select->condition);
+            constant(select->true_value);
+            constant(select->false_value);
+            copy.var = select;
+        } break;
+        case Instruction::Type::Alloca: break;
+        case Instruction::Type::Load: {
+            auto load = copied<InstructionDetails::Load>(inst);
+            constant(load->point);
+            copy.var = load;
+        } break;
+        case Instruction::Type::Store: {
+            auto store = copied<InstructionDetails::Store>(inst);
+            constant(store->value);
+            constant(store->point);
+            copy.var = store;
+        } break;
+        case Instruction::Type::GetElementPtr: {
+            auto gep = copied<InstructionDetails::GetElementPtr>(inst);
+            constant(gep->ptr_value);
+            copy.var = gep;
+        } break;
+        case Instruction::Type::Call: {
+            auto call = copied<InstructionDetails::Call>(inst);
+            call->name = rename(call->name);
+            for (auto& argument : call->arguments) constant(argument.value);
+            copy.var = call;
+        } break;
+        default: PANIC("TODO!", "");
+    }
+    return copy;
+}
+
+static std::uint64_t hash_function(SymbolIndex& symbols, const Function& fn, const Vec<BasicBlock>& body,
+                                   FunctionReferences& references) {
+    StructuralHasher h;
+    auto number = [&](usz n) { h.u64(n); };
+    auto text = [&](const std::string& s) { h.string(s); };
+
+    h.optional(fn.linkage, [&](auto v) { h.tag(v); });
+    // Private and internal functions are renamed after the module.
+    if (is_local_linkage(fn.linkage)) h.string(symbols.module.name);
+    h.optional(fn.preemption_specifier, [&](auto v) { h.tag(v); });
+    h.optional(fn.visibility, [&](auto v) { h.tag(v); });
+    h.optional(fn.dll_storage_class, [&](auto v) { h.tag(v); });
+    hash_signature(h, fn.calling_convention, fn.return_type, fn.function_name, fn.parameters);
+    h.u64(fn.unnamed_addr);
+    h.u64(fn.local_unnamed_addr);
+    h.optional(fn.addr_space, number);
+    h.optional(fn.section, text);
+    h.optional(fn.partition, text);
+    h.optional(fn.alignment, number);
+    hash_attachments(h, symbols, fn.metadata, references);
+
+    h.u64(body.size());
+    for (const auto& bb : body) {
+        h.string(bb.name);
+        h.u64(bb.instructions.size());
+        for (const auto& inst : bb.instructions)
+            hash_instruction(h, symbols, inst, references);
+    }
+
+    // Declarations the body depends on, in order of first use, hashed in
+    // the form stream_function_cache writes them.
+    for (const auto& name : references.functions) {
+        if (auto i = symbols.function(name)) {
+            h.u64(1);
+            h.string(generate<ExternalFunction>(declaration_of(symbols.module, symbols.module.functions.at(i.value()))));
+        } else if (auto j = symbols.external_function(name)) {
+            h.u64(2);
+            h.string(generate<ExternalFunction>(symbols.module.external_functions.at(j.value())));
+        } else {
+            h.u64(0);
+        }
+    }
+    for (const auto& name : references.global_variables) {
+        auto i = symbols.global_variable(name);
+        h.u64(i.has_value());
+        if (!i.has_value()) continue;
+        const auto& var = symbols.module.global_variables.at(i.value());
+        h.string(declaration_of(symbols.module, var));
+        // A constant's value can be folded into the function.
+        if (!var.global) hash_constant(h, var.initializer_constant, nullptr);
+    }
+    return h.state;
+}
+
+// Calls `each(fn, hash, references)` for every function, producing lazy
+// bodies into a temporary that is freed again before the next function.
+template <typename F> static Vec<std::uint64_t> for_each_function_hash(Module& module, F each) {
+    SymbolIndex symbols{.module = module};
+    Vec<std::uint64_t> hashes;
+    for (usz i = 0; i < module.functions.size(); i++) {
+        const Function *fn = &module.functions.at(i);
+        Function materialized;
+        Arena arena;
+        if (fn->body.empty() && fn->body_producer) {
+            Arena::Scope scope(&arena);
+            materialized = *fn;
+            materialized.body = materialized.body_producer();
+            fn = &materialized;
+        }
+        FunctionReferences references;
+        auto hash = hash_function(symbols, *fn, fn->body, references);
+        hashes.push_back(hash);
+        each(*fn, hash, references, symbols);
+    }
+    return hashes;
+}
+
+Vec<std::uint64_t> Module::function_hashes() {
+    return for_each_function_hash(*this, [](auto&&...) {});
+}
+
+// Declares `name` if it is a function of the module.
+static void declare_function(std::stringstream& ss, SymbolIndex& symbols, const std::string& name) {
+    if (auto i = symbols.function(name)) {
+        ss << generate<ExternalFunction>(declaration_of(symbols.module, symbols.module.functions.at(i.value()))) << "\n";
+    } else if (auto j = symbols.external_function(name)) {
+        ss << generate<ExternalFunction>(symbols.module.external_functions.at(j.value())) << "\n";
+    }
+}
+
+// Writes `nodes` and everything they refer to. Nodes keep their module
+// numbering; gaps are allowed.
+static void write_metadata(std::stringstream& ss, const MetadataTable& table, Vec<usz> pending) {
+    Vec<usz> nodes;
+    std::unordered_set<usz> seen;
+    while (!pending.empty()) {
+        usz node = pending.back();
+        pending.pop_back();
+        if (!seen.insert(node).second) continue;
+        nodes.push_back(node);
+        for (const auto& operand : table.operands.at(node))
+            if (MetadataTable::is_reference(operand)) pending.push_back(std::stoul(operand.substr(1)));
+    }
+    std::sort(nodes.begin(), nodes.end());
+    for (usz node : nodes)
+        ss << "!" << node << " = " << table.nodes.at(node) << "\n";
+}
+
+// Writes through a uniquely named temporary and a rename, so that neither a
+// concurrent writer nor a failed write leaves a partial file under `path`.
+static void write_file(const std::filesystem::path& path, const std::string& contents) {
+    static const std::uint64_t process = (static_cast<std::uint64_t>(std::random_device{}()) << 32) ^ std::random_device{}();
+    static std::atomic<std::uint64_t> counter{0};
+    char suffix[64];
+    std::snprintf(suffix, sizeof(suffix), ".%016llx-%llu.tmp", static_cast<unsigned long long>(process),
+                  static_cast<unsigned long long>(counter++));
+    auto temporary = path;
+    temporary += suffix;
+
+    std::ofstream out(temporary, std::ios::binary);
+    out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+    out.flush();
+    bool written = out.good();
+    out.close();
+    std::error_code error;
+    if (written && !out.fail()) std::filesystem::rename(temporary, path, error);
+    if (!written || out.fail() || error) {
+        std::error_code ignored;
+        std::filesystem::remove(temporary, ignored);
+        PANIC("could not write %s", path.c_str());
+    }
+}
+
+static std::filesystem::path cache_path(const std::string& directory, const char *prefix, std::uint64_t hash) {
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s%016llx.ll", prefix, static_cast<unsigned long long>(hash));
+    return std::filesystem::path(directory) / name;
+}
+
+Module::FunctionCache Module::stream_function_cache(const std::string& directory) {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) PANIC("could not create %s: %s", directory.c_str(), error.message().c_str());
+
+    FunctionCache cache;
+    cache.function_hashes = for_each_function_hash(*this, [&](const Function& fn, std::uint64_t hash,
+                                                              const FunctionReferences& references, SymbolIndex& symbols) {
+        auto path = cache_path(directory, "", hash);
+        if (std::filesystem::exists(path)) return;
+
+        Arena arena; // owns the renamed copies
+        Arena::Scope scope(&arena);
+        auto rename = [&](const std::string& name) { return cache_name(symbols, name); };
+        auto definition = promoted(*this, fn);
+        auto is_renamed = [&](const std::string& name) { return rename(name) != name; };
+        if (std::ranges::any_of(references.functions, is_renamed) || std::ranges::any_of(references.global_variables, is_renamed))
+            for (auto& bb : definition.body)
+                for (auto& inst : bb.instructions) inst = renamed(inst, rename);
+
+        std::stringstream ss;
+        for (const auto& global : references.global_variables)
+            if (auto i = symbols.global_variable(global))
+                ss << declaration_of(*this, this->global_variables.at(i.value()));
+        for (const auto& callee : references.functions)
+            if (callee != fn.function_name) declare_function(ss, symbols, callee);
+        ss << "\n" << generate<Function>(definition) << "\n";
+        write_metadata(ss, this->metadata, references.metadata);
+        write_file(path, ss.str());
+    });
+    if (this->global_variables.empty()) return cache;
+
+    // Every global is defined once, in a file of its own, named after a hash
+    // of its text.
+    SymbolIndex symbols{.module = *this};
+    Arena arena;
+    Arena::Scope scope(&arena);
+    auto rename = [&](const std::string& name) { return cache_name(symbols, name); };
+    std::stringstream ss;
+    std::unordered_set<std::string> declared;
+    Vec<usz> metadata;
+    for (const auto& var : this->global_variables) {
+        auto definition = promoted(*this, var);
+        definition.initializer_constant = renamed(var.initializer_constant, rename);
+        ss << generate<GlobalVariable>(definition);
+        for_each_global_reference(var.initializer_constant, [&](const std::string& name) {
+            if (declared.insert(name).second) declare_function(ss, symbols, name);
+        });
+        for (const auto& attachment : var.metadata) metadata.push_back(attachment.node);
+    }
+    ss << "\n";
+    write_metadata(ss, this->metadata, metadata);
+
+    StructuralHasher h;
+    h.string(ss.str());
+    cache.globals_hash = h.state;
+    auto path = cache_path(directory, "globals-", h.state);
+    if (!std::filesystem::exists(path)) write_file(path, ss.str());
+    return cache;
+}
+
+// Keeps symbols[i] where live[i].
+template <typename T> static void compact(Vec<T>& symbols, const Vec<bool>& live) {
+    usz kept = 0;
+    for (usz i = 0; i < symbols.size(); i++)
+        if (live[i]) {
+            if (kept != i) symbols[kept] = std::move(symbols[i]);
+            kept++;
+        }
+    symbols.resize(kept);
+}
+
+Module& Module::prune(const Vec<std::string>& roots) {
+    enum class Kind { Function, ExternalFunction, GlobalVariable };
+    struct Symbol {
+        Kind kind;
+        usz index;
+    };
+    std::unordered_map<std::string, Symbol> symbols;
+    for (usz i = 0; i < this->functions.size(); i++)
+        symbols.try_emplace(this->functions[i].function_name, Symbol{Kind::Function, i});
+    for (usz i = 0; i < this->global_variables.size(); i++)
+        symbols.try_emplace(this->global_variables[i].global_var_name, Symbol{Kind::GlobalVariable, i});
+
+    // Producers may declare intrinsics while being scanned, so declarations
+    // are indexed again on a miss.
+    Vec<bool> live_functions(this->functions.size()), live_external_functions,
+              live_global_variables(this->global_variables.size());
+    auto index_external_functions = [&] {
+        for (usz i = live_external_functions.size(); i < this->external_functions.size(); i++)
+            symbols.try_emplace(this->external_functions[i].function_name, Symbol{Kind::ExternalFunction, i});
+        live_external_functions.resize(this->external_functions.size());
+    };
+    index_external_functions();
+
+    Vec<Symbol> worklist;
+    auto reach = [&](const std::string& name) {
+        auto it = symbols.find(name);
+        if (it == symbols.end() && live_external_functions.size() < this->external_functions.size()) {
+            index_external_functions();
+            it = symbols.find(name);
+        }
+        if (it == symbols.end()) return;
+        auto symbol = it->second;
+        auto& live = symbol.kind == Kind::Function ? live_functions
+                   : symbol.kind == Kind::ExternalFunction ? live_external_functions
+                   : live_global_variables;
+        if (live[symbol.index]) return;
+        live[symbol.index] = true;
+        worklist.push_back(symbol);
+    };
+
+    for (const auto& name : roots) reach(name);
+    for (const auto& fn : this->functions)
+        if (!is_local_linkage(fn.linkage)) reach(fn.function_name);
+    for (const auto& var : this->global_variables)
+        if (!is_local_linkage(var.linkage)) reach(var.global_var_name);
+
+    while (!worklist.empty()) {
+        auto symbol = worklist.back();
+        worklist.pop_back();
+        switch (symbol.kind) {
+            case Kind::Function: {
+                const auto& fn = this->functions.at(symbol.index);
+                Vec<BasicBlock> produced;
+                Arena arena;
+                if (fn.body.empty() && fn.body_producer) {
+                    usz functions = this->functions.size(), global_variables = this->global_variables.size();
+                    {
+                        Arena::Scope scope(&arena);
+                        produced = fn.body_producer();
+                    }
+                    if (this->functions.size() != functions || this->global_variables.size() != global_variables)
+                        PANIC("the body producer of @%s added functions or globals during prune",
+                              this->functions.at(symbol.index).function_name.c_str());
+                }
+                const auto& body = produced.empty() ? fn.body : produced;
+                for (const auto& bb : body)
+                    for (const auto& inst : bb.instructions)
+                        for_each_global_reference(inst, reach);
+            } break;
+            case Kind::GlobalVariable:
+                for_each_global_reference(this->global_variables.at(symbol.index).initializer_constant, reach);
+                break;
+            case Kind::ExternalFunction: break;
+        }
+    }
+
+    index_external_functions();
+    for (usz i = 0; i < this->external_functions.size(); i++)
+        if (!live_external_functions[i]) this->declared_intrinsics.erase(this->external_functions[i].function_name);
+    compact(this->functions, live_functions);
+    compact(this->external_functions, live_external_functions);
+    compact(this->global_variables, live_global_variables);
+    return *this;
+}
+
 } // namespace LLVM
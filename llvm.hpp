@@ -2,7 +2,13 @@
 #define LLVM_H
 
 #include <string>
+#include <functional>
 #include <optional>
+#include <ostream>
+#include <span>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 #include <variant>
@@ -20,6 +26,38 @@ template <typename...Args> using Var = std::variant<Args...>;
 
 template <typename T> std::string generate([[maybe_unused]] T);
 
+// Owns what the factories below (Type::*, Constant::*, Instruction::*)
+// allocate while it is current, and frees it when destroyed. Lazily produced
+// function bodies are built under one, so they don't outlive their emission;
+// everywhere else factory allocations live as long as the program, as before.
+struct Arena {
+    static inline thread_local Arena *current{nullptr};
+
+    // Makes `arena` current for its lifetime; nullptr suspends tracking.
+    struct Scope {
+        Arena *previous;
+        explicit Scope(Arena *arena) : previous(current) { current = arena; }
+        ~Scope() { current = previous; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    Vec<std::pair<void *, void (*)(void *)>> objects{};
+
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena() {
+        for (auto it = this->objects.rbegin(); it != this->objects.rend(); it++)
+            it->second(it->first);
+    }
+
+    template <typename T> static T *track(T *object) {
+        if (current) current->objects.emplace_back(object, [](void *p) { delete static_cast<T *>(p); });
+        return object;
+    }
+};
+
 enum class Linkage {
     Private, Internal, AvailableExternally,
     Linkonce, Weak, Common, Appending,
@@ -49,7 +87,7 @@ enum class CallingConvention {
 
 template <> std::string generate<Linkage>(Linkage);
 template <> std::string generate<PreemptionSpecifier>([[maybe_unused]] PreemptionSpecifier);
-template <> std::string generate<Visibility>([[maybe_unused]] Visibility);
+template <> std::string generate<Visibility>(Visibility);
 template <> std::string generate<DLLStorageClass>(DLLStorageClass);
 template <> std::string generate<ThreadLocal>(ThreadLocal);
 template <> std::string generate<CodeModel>(CodeModel);
@@ -68,48 +106,166 @@ struct Type {
     Kind kind;
     Type *inner{nullptr}; // For Pointer, Vector, and Array
     usz size{0}; // For Vector, Array, and Integer
+    Vec<Type> members{}; // For Structure
 
+    static Type *Void() {
+        return Arena::track(new Type{ .kind = Kind::Void });
+    }
     static Type *Integer(usz integer_size = 32) {
-        return new Type{ .kind = Kind::Integer, .size = integer_size };
+        return Arena::track(new Type{ .kind = Kind::Integer, .size = integer_size });
+    }
+    static Type *Float() {
+        return Arena::track(new Type{ .kind = Kind::Float });
+    }
+    static Type *Double() {
+        return Arena::track(new Type{ .kind = Kind::Double });
+    }
+    static Type *Vector(Type *inner, usz size) {
+        return Arena::track(new Type { .kind = Kind::Vector, .inner = inner, .size = size });
     }
     static Type *Array(Type *inner, usz size) {
-        return new Type { .kind = Kind::Array, .inner = inner, .size = size };
+        return Arena::track(new Type { .kind = Kind::Array, .inner = inner, .size = size });
     }
     static Type *Pointer(Type *inner) {
-        return new Type { .kind = Kind::Pointer, .inner = inner };
+        return Arena::track(new Type { .kind = Kind::Pointer, .inner = inner });
+    }
+    static Type *Structure(const Vec<Type>& members) {
+        return Arena::track(new Type { .kind = Kind::Structure, .members = members });
     }
 };
 
 template <> std::string generate<Type>(Type);
 
+// Packed primitive values backing a bulk array initializer, formatted in
+// one pass rather than as one Constant per element.
+struct ConstantData {
+    enum class Element { I8, I16, I32, I64, Float, Double };
+
+    Element element;
+    usz count{0};
+    std::string bytes{}; // `count` native values
+};
+
 struct Constant {
-    enum class Type { Boolean, Integer, Float, Null, String, LocalVariable, GlobalVariable };
+    enum class Type {
+        Boolean, Integer, Float, Null, String, LocalVariable, GlobalVariable,
+        Array, Struct, Vector, ZeroInitializer, Data,
+    };
+    struct Element;
 
     Type type;
     union {
         bool bool_value;
         long long int_value;
         double float_value;
-        const char *string_value;
-        const char *variable_name;
+        const std::string *string_value; // arbitrary bytes, escaped on output
+        const std::string *variable_name;
+        const Vec<Element> *elements; // For Array, Struct, and Vector
+        const ConstantData *data;
     };
 
+    static Constant Boolean(bool value) {
+        return Constant{.type = Type::Boolean, .bool_value = value};
+    }
     static Constant Integer(long long value) {
         return Constant{.type = Type::Integer, .int_value = value};
     }
     static Constant String(const std::string& value) {
-        return Constant{.type = Type::String, .string_value = value.c_str()};
+        return Constant{.type = Type::String, .string_value = Arena::track(new std::string(value))};
     }
     static Constant LocalVariable(const std::string& name) {
-        return Constant{.type = Type::LocalVariable, .variable_name = name.c_str()};
+        return Constant{.type = Type::LocalVariable, .variable_name = Arena::track(new std::string(name))};
     }
     static Constant GlobalVariable(const std::string& name) {
-        return Constant{.type = Type::GlobalVariable, .variable_name = name.c_str()};
+        return Constant{.type = Type::GlobalVariable, .variable_name = Arena::track(new std::string(name))};
+    }
+    static Constant Null() {
+        return Constant{.type = Type::Null};
+    }
+    static Constant ZeroInitializer() {
+        return Constant{.type = Type::ZeroInitializer};
     }
+    static Constant Array(const Vec<Element>& elements) {
+        return Constant{.type = Type::Array, .elements = Arena::track(new Vec<Element>(elements))};
+    }
+    static Constant Struct(const Vec<Element>& elements) {
+        return Constant{.type = Type::Struct, .elements = Arena::track(new Vec<Element>(elements))};
+    }
+    static Constant Vector(const Vec<Element>& elements) {
+        return Constant{.type = Type::Vector, .elements = Arena::track(new Vec<Element>(elements))};
+    }
+
+    // Bulk array initializers; the values are copied. All-zero tables print
+    // as `zeroinitializer`, and byte tables as `c"..."` when that is shorter.
+    static Constant Array(std::span<const std::int8_t> values) { return packed(ConstantData::Element::I8, values); }
+    static Constant Array(std::span<const std::uint8_t> values) { return packed(ConstantData::Element::I8, values); }
+    static Constant Array(std::span<const std::int16_t> values) { return packed(ConstantData::Element::I16, values); }
+    static Constant Array(std::span<const std::int32_t> values) { return packed(ConstantData::Element::I32, values); }
+    static Constant Array(std::span<const std::int64_t> values) { return packed(ConstantData::Element::I64, values); }
+    static Constant Array(std::span<const float> values) { return packed(ConstantData::Element::Float, values); }
+    static Constant Array(std::span<const double> values) { return packed(ConstantData::Element::Double, values); }
+
+    template <typename T> static Constant packed(ConstantData::Element element, std::span<const T> values) {
+        auto bytes = reinterpret_cast<const char *>(values.data());
+        return Constant{.type = Type::Data, .data = Arena::track(new ConstantData{
+            .element = element,
+            .count = values.size(),
+            .bytes = std::string(bytes, values.size_bytes()),
+        })};
+    }
+};
+
+struct Constant::Element {
+    ::LLVM::Type type;
+    Constant value{};
 };
 
 template <> std::string generate<Constant>(Constant);
 
+// https://llvm.org/docs/LangRef.html#metadata
+// Metadata nodes live in a per-module table; instructions, functions and
+// globals refer to them by index, which is printed as `!<index>`.
+struct MetadataAttachment {
+    std::string kind; // without the leading '!', e.g. "prof"
+    usz node;
+};
+
+struct MetadataTable {
+    Vec<std::string> nodes{}; // printed node bodies, e.g. `!{!"branch_weights", i32 1, i32 9}`
+    Vec<Vec<std::string>> operands{}; // per node, without a distinct node's self reference
+    std::unordered_map<std::string, usz> ids{};
+
+    static std::string string(const std::string& value); // escaped like c"..." strings
+    static std::string reference(usz node) { return "!" + std::to_string(node); }
+    static bool is_reference(const std::string& operand) {
+        return operand.size() > 1 && operand[0] == '!' && operand[1] >= '0' && operand[1] <= '9';
+    }
+    static std::string value(::LLVM::Type type, Constant constant);
+
+    // Uniqued: structurally identical nodes share an index.
+    usz node(const Vec<std::string>& operands);
+    // Never uniqued; the node's first operand refers to itself (as loop IDs require).
+    usz distinct_self_node(const Vec<std::string>& operands);
+
+    // https://llvm.org/docs/BranchWeightMetadata.html
+    // Weights above UINT32_MAX are scaled down, keeping their ratios.
+    usz branch_weights(const Vec<usz>& weights);
+    usz function_entry_count(usz count);
+
+    // https://llvm.org/docs/LangRef.html#llvm-loop
+    usz loop(const Vec<usz>& properties) {
+        Vec<std::string> operands;
+        for (auto property : properties) operands.push_back(reference(property));
+        return this->distinct_self_node(operands);
+    }
+    usz loop_property(const std::string& name) { return this->node({string(name)}); }
+    usz loop_property(const std::string& name, usz value);
+    usz loop_vectorize_width(usz width) { return this->loop_property("llvm.loop.vectorize.width", width); }
+    usz loop_unroll_count(usz count) { return this->loop_property("llvm.loop.unroll.count", count); }
+};
+
+template <> std::string generate<MetadataTable>(MetadataTable);
+
 struct FunctionParameter {
     Type type;
     // TODO: parameter attrs (what in the fuck nuts is an attribute and why the fuck is it not documented.)
@@ -122,6 +278,30 @@ namespace InstructionDetails {
         ::LLVM::Type type;
         Opt<Constant> value{None};
     };
+    struct Br {
+        // br i1 <cond>, label <iftrue>, label <iffalse>
+        // br label <dest>
+        Opt<Constant> condition{None};
+        std::string if_true;
+        Opt<std::string> if_false{None};
+    };
+    struct Switch {
+        // switch <intty> <value>, label <defaultdest> [ <intty> <val>, label <dest> ... ]
+        struct Case {
+            Constant value{};
+            std::string destination;
+        };
+
+        ::LLVM::Type type;
+        Constant value{};
+        std::string default_destination;
+        Vec<Case> cases{};
+
+        Switch *add_case(Case c) {
+            this->cases.push_back(c);
+            return this;
+        }
+    };
     struct Alloca {
         bool inalloca{false};
         ::LLVM::Type type;
@@ -153,6 +333,31 @@ namespace InstructionDetails {
         Constant ptr_value{};
         // TODO: vector index (???)
     };
+    struct Phi {
+        // <result> = phi [fast-math-flags] <ty> [ <val0>, <label0>], ...
+        // TODO: fast-math flags
+        struct Incoming {
+            Constant value{};
+            std::string block;
+        };
+
+        ::LLVM::Type type;
+        Vec<Incoming> incoming{};
+
+        Phi *add_incoming(Incoming in) {
+            this->incoming.push_back(in);
+            return this;
+        }
+    };
+    struct Select {
+        // <result> = select [fast-math flags] selty <cond>, <ty> <val1>, <ty> <val2>
+        // TODO: fast-math flags
+        ::LLVM::Type condition_type;
+        Constant condition{};
+        ::LLVM::Type type;
+        Constant true_value{};
+        Constant false_value{};
+    };
     struct Call {
         // <result> = [tail | musttail | notail ] call [fast-math flags] [cconv] [ret attrs] [addrspace(<num>)]
         //            <ty>|<fnty> <fnptrval>(<function args>) [fn attrs] [ operand bundles ]
@@ -213,42 +418,89 @@ struct Instruction {
     Opt<std::string> name{None};
     Var<
             InstructionDetails::Ret *,
+            InstructionDetails::Br *,
+            InstructionDetails::Switch *,
             InstructionDetails::Alloca *,
             InstructionDetails::Load *,
             InstructionDetails::Store *,
             InstructionDetails::GetElementPtr *,
+            InstructionDetails::Phi *,
+            InstructionDetails::Select *,
             InstructionDetails::Call *> var;
+    Vec<MetadataAttachment> metadata{};
 
     static Instruction from(InstructionDetails::Ret *var) { return Instruction{.type = Type::Ret, .var = var}; }
+    static Instruction from(InstructionDetails::Br *var) { return Instruction{.type = Type::Br, .var = var}; }
+    static Instruction from(InstructionDetails::Switch *var) { return Instruction{.type = Type::Switch, .var = var}; }
+    static Instruction from(InstructionDetails::Phi *var) { return Instruction{.type = Type::Phi, .var = var}; }
+    static Instruction from(InstructionDetails::Select *var) { return Instruction{.type = Type::Select, .var = var}; }
     static Instruction from(InstructionDetails::Call *var) { return Instruction{.type = Type::Call, .var = var}; }
     static Instruction from(InstructionDetails::GetElementPtr *var) { return Instruction{.type = Type::GetElementPtr, .var = var}; }
 
     static InstructionDetails::Ret *Ret(::LLVM::Type return_type) {
-        return new InstructionDetails::Ret{return_type};
+        return Arena::track(new InstructionDetails::Ret{return_type});
     }
     static InstructionDetails::Ret *Ret(::LLVM::Type return_type, Constant value) {
-        return new InstructionDetails::Ret{return_type, std::make_optional(value)};
+        return Arena::track(new InstructionDetails::Ret{return_type, std::make_optional(value)});
+    }
+
+    static InstructionDetails::Br *Br(const std::string& destination) {
+        return Arena::track(new InstructionDetails::Br{.if_true = destination});
+    }
+    static InstructionDetails::Br *Br(Constant condition, const std::string& if_true, const std::string& if_false) {
+        return Arena::track(new InstructionDetails::Br{
+            .condition = std::make_optional(condition),
+            .if_true = if_true,
+            .if_false = std::make_optional(if_false),
+        });
+    }
+
+    static InstructionDetails::Switch *Switch(::LLVM::Type type, Constant value, const std::string& default_destination) {
+        return Arena::track(new InstructionDetails::Switch{
+            .type = type,
+            .value = value,
+            .default_destination = default_destination,
+        });
+    }
+
+    static InstructionDetails::Phi *Phi(::LLVM::Type type) {
+        return Arena::track(new InstructionDetails::Phi{.type = type});
+    }
+
+    static InstructionDetails::Select *Select(Constant condition, ::LLVM::Type type, Constant true_value, Constant false_value) {
+        return Arena::track(new InstructionDetails::Select{
+            .condition_type = *::LLVM::Type::Integer(1),
+            .condition = condition,
+            .type = type,
+            .true_value = true_value,
+            .false_value = false_value,
+        });
     }
 
     static InstructionDetails::Call *Call(::LLVM::Type return_type, const std::string& name) {
-        return new InstructionDetails::Call{
+        return Arena::track(new InstructionDetails::Call{
             .return_type = return_type,
             .name = name,
-        };
+        });
     }
 
     static InstructionDetails::GetElementPtr *GetElementPtr(::LLVM::Type type, LLVM::Type ptr_type, Constant ptr_value) {
-        return new InstructionDetails::GetElementPtr{
+        return Arena::track(new InstructionDetails::GetElementPtr{
             .type = type,
             .ptr_type = ptr_type,
             .ptr_value = ptr_value,
-        };
+        });
     }
 
     Instruction set_name(const std::string& name) {
         this->name = std::make_optional(name);
         return *this;
     }
+
+    Instruction add_metadata(const std::string& kind, usz node) {
+        this->metadata.push_back({kind, node});
+        return *this;
+    }
 };
 
 template <> std::string generate<Instruction>(Instruction);
@@ -269,6 +521,59 @@ struct BasicBlock {
 
 template <> std::string generate<BasicBlock>(BasicBlock);
 
+// Successor/predecessor view of a function body, indexed by block. Blocks are
+// folded in one at a time as they are appended (see `sync`), and refolded when
+// Function::add_instruction changes their terminator, so queries never rescan
+// the body. Blocks referenced by a terminator before being defined get a
+// placeholder node. Dominators are computed on demand with the iterative
+// Cooper-Harvey-Kennedy algorithm and cached until the edges change.
+struct ControlFlowGraph {
+    static constexpr usz npos = static_cast<usz>(-1);
+
+    struct Node {
+        std::string name;
+        bool defined{false};
+        usz block{npos}; // index into the body once defined
+        Vec<usz> successors{};
+        Vec<usz> predecessors{};
+        // What the edges were folded from, to spot blocks edited in place.
+        usz folded_size{0};
+        const void *folded_terminator{nullptr};
+    };
+
+    Vec<Node> nodes{}; // nodes[0] is the entry block once anything is synced
+    std::unordered_map<std::string, usz> indices{};
+    usz synced{0}; // number of body blocks already folded into the graph
+
+    Vec<usz> idom{}; // npos for the entry block and unreachable blocks
+    Vec<usz> dom_pre{}, dom_post{}; // dominator tree DFS numbering
+    bool dominators_valid{false};
+
+    Opt<usz> index_of(const std::string& name) const {
+        auto it = this->indices.find(name);
+        if (it == this->indices.end()) return None;
+        return it->second;
+    }
+    const Vec<usz>& successors(usz block) const { return this->nodes.at(block).successors; }
+    const Vec<usz>& predecessors(usz block) const { return this->nodes.at(block).predecessors; }
+
+    // Folds body[synced..] into the graph.
+    void sync(const Vec<BasicBlock>& body);
+    // sync, then refolds every block whose last instruction changed since it
+    // was folded. Linear in the number of blocks.
+    void refresh(const Vec<BasicBlock>& body);
+    // Replaces the node's outgoing edges with those of the block's terminator.
+    void fold(usz node, const BasicBlock& bb);
+
+    Opt<usz> immediate_dominator(usz block);
+    // Unreachable blocks are not part of the dominator tree and are never dominated.
+    bool dominates(usz a, usz b);
+
+    usz node(const std::string& name);
+    void add_edge(usz from, usz to);
+    void compute_dominators();
+};
+
 struct GlobalVariable {
     std::string global_var_name /* REQUIRED */;
     Opt<Linkage> linkage{None};
@@ -291,13 +596,17 @@ struct GlobalVariable {
          no_sanitize_hwaddress{false},
          sanitize_address_dyninit{false},
          sanitize_memtag{false};
-    // TODO: metadata
+    Vec<MetadataAttachment> metadata{};
 
     static GlobalVariable create(std::string name, Type type, Constant value) {
         return GlobalVariable{.global_var_name = std::move(name), .type = type, .initializer_constant = value};
     }
 
     GlobalVariable set_linkage(Linkage linkage) { this->linkage = linkage; return *this; }
+    GlobalVariable add_metadata(const std::string& kind, usz node) {
+        this->metadata.push_back({kind, node});
+        return *this;
+    }
 
 };
 
@@ -327,8 +636,17 @@ struct Function {
     // TODO: prefix constant
     // TODO: prologue constant
     // TODO: personality constant
-    // TODO: metadata
+    Vec<MetadataAttachment> metadata{};
     Vec<BasicBlock> body;
+    ControlFlowGraph cfg{}; // kept current by add_basic_block
+    // If set and `body` is empty, called by generate<Function> to build the
+    // body, which only lives as long as that call: the producer runs under an
+    // Arena, so whatever it allocates through the factories is freed once the
+    // body has been written. It is called again on every generation (and by
+    // Module::function_hashes and Module::prune), so it must be
+    // deterministic, and it may declare intrinsics but not add functions or
+    // globals to a module.
+    std::function<Vec<BasicBlock>()> body_producer{};
 
     static Function create(const std::string& name, Type return_type) {
         return Function{.return_type = return_type, .function_name = name};
@@ -339,10 +657,42 @@ struct Function {
         return *this;
     }
 
-    Function add_basic_block(const BasicBlock& bb) {
+    // Appending to a named Function mutates it in place and returns it by
+    // reference, so building a large body doesn't copy it (and its CFG) per
+    // block; chaining on a temporary moves it along instead.
+    Function& add_basic_block(const BasicBlock& bb) & {
         this->body.push_back(bb);
+        this->cfg.sync(this->body);
+        return *this;
+    }
+    Function add_basic_block(const BasicBlock& bb) && { return std::move(this->add_basic_block(bb)); }
+
+    // Appends to an already added block, keeping the CFG current if this
+    // adds its terminator. Panics if the block already has one.
+    Function& add_instruction(const std::string& block, const Instruction& instruction) &;
+    Function add_instruction(const std::string& block, const Instruction& instruction) && {
+        return std::move(this->add_instruction(block, instruction));
+    }
+
+    Function add_metadata(const std::string& kind, usz node) {
+        this->metadata.push_back({kind, node});
+        return *this;
+    }
+
+    Function set_body_producer(std::function<Vec<BasicBlock>()> producer) {
+        this->body_producer = std::move(producer);
         return *this;
     }
+
+    // Panics on branches to undefined blocks, on terminators before the end
+    // of a block, on phi nodes after other instructions, on phi nodes whose
+    // incoming blocks don't match the block's predecessor edges, and on phi
+    // nodes giving one predecessor different values. Blocks edited in place
+    // through `body` are refolded first.
+    void verify();
+    // Also panics on branch weights (`!prof`, looked up in `metadata`) whose
+    // count doesn't match their instruction's successors.
+    void verify(const MetadataTable& metadata);
 };
 
 template <> std::string generate<Function>(Function);
@@ -377,6 +727,120 @@ struct ExternalFunction {
 
 template <> std::string generate<ExternalFunction>(ExternalFunction);
 
+// https://llvm.org/docs/LangRef.html#intrinsic-functions
+// A fully mangled intrinsic signature. Overloaded intrinsics get their type
+// suffixes from `mangle`, e.g. Memcpy(i8*, i8*, i64) is `llvm.memcpy.p0i8.p0i8.i64`.
+struct Intrinsic {
+    enum class VectorReduction {
+        Add, Mul, And, Or, Xor, Smax, Smin, Umax, Umin, // integer
+        Fadd, Fmul, Fmax, Fmin,                         // floating point
+    };
+
+    std::string name;
+    Type return_type;
+    Vec<Type> parameter_types{};
+
+    static std::string mangle(Type type);
+
+    static Intrinsic Memcpy(Type dst, Type src, Type length);
+    static Intrinsic Memmove(Type dst, Type src, Type length);
+    static Intrinsic Memset(Type dst, Type length);
+    static Intrinsic Prefetch(Type address);
+    static Intrinsic Expect(Type type);
+    static Intrinsic Assume();
+    static Intrinsic LifetimeStart(Type pointer);
+    static Intrinsic LifetimeEnd(Type pointer);
+    static Intrinsic Ctpop(Type type);
+    static Intrinsic Ctlz(Type type);
+    static Intrinsic Cttz(Type type);
+    static Intrinsic Fma(Type type);
+    // Panics unless `vector` is a vector of integers (for the integer
+    // reductions) or of floating point values (for the others).
+    static Intrinsic VectorReduce(VectorReduction reduction, Type vector);
+
+    ExternalFunction declaration() const;
+    // Panics if the argument count doesn't match the signature.
+    InstructionDetails::Call *call(const Vec<Constant>& arguments) const;
+};
+
+template <> std::string generate<Intrinsic::VectorReduction>(Intrinsic::VectorReduction);
+
+// Accumulates a whole translation unit. Unlike the other builders these
+// return a reference, since a module is built up incrementally and is
+// usually far too large to copy per call.
+struct Module {
+    // Only used to tell modules apart in a shared function cache; see
+    // stream_function_cache.
+    std::string name{};
+    Vec<GlobalVariable> global_variables{};
+    Vec<Function> functions{};
+    Vec<ExternalFunction> external_functions{};
+    MetadataTable metadata{};
+    std::unordered_set<std::string> declared_intrinsics{};
+
+    // These panic while an Arena is current (i.e. inside a body producer),
+    // since anything allocated there is freed once the body is written.
+    Module& add_global_variable(const GlobalVariable& var) {
+        if (Arena::current) PANIC("cannot add @%s to a module from a body producer", var.global_var_name.c_str());
+        this->global_variables.push_back(var);
+        return *this;
+    }
+    Module& add_function(const Function& fn) {
+        if (Arena::current) PANIC("cannot add @%s to a module from a body producer", fn.function_name.c_str());
+        this->functions.push_back(fn);
+        return *this;
+    }
+    Module& add_external_function(const ExternalFunction& fn) {
+        if (Arena::current) PANIC("cannot add @%s to a module from a body producer", fn.function_name.c_str());
+        this->external_functions.push_back(fn);
+        return *this;
+    }
+
+    // Declares the intrinsic the first time it is used. The declaration gets
+    // its own copy of the types, so this is safe from a body producer.
+    InstructionDetails::Call *call_intrinsic(const Intrinsic& intrinsic, const Vec<Constant>& arguments);
+
+    // Writes the module one function at a time, so functions with a body
+    // producer are materialized, written and freed in turn and peak memory is
+    // bounded by the largest single function (provided the producer builds
+    // it through the factories). Declarations and metadata come last, which
+    // lets producers still declare intrinsics and add metadata.
+    void stream(std::ostream& os);
+
+    // Structural hash of each function, in order, computed from its
+    // signature, body and metadata and from the declarations of the functions
+    // and globals it references, as stream_function_cache writes them (plus
+    // the initializers of referenced constants). Stable across runs, compilers and platforms.
+    Vec<std::uint64_t> function_hashes();
+
+    struct FunctionCache {
+        Vec<std::uint64_t> function_hashes{}; // in function order
+        Opt<std::uint64_t> globals_hash{None}; // None if the module has no globals
+    };
+
+    // Writes each function as a standalone module `<directory>/<hash>.ll`
+    // holding declarations for everything it references, and all global
+    // variables to `<directory>/globals-<hash>.ll`; linking the files named
+    // by the returned hashes gives the module. Private and internal symbols
+    // are made external and hidden in these files so that they resolve
+    // across them, and renamed `<name>.<hash of Module::name>`, so modules
+    // with different names can share a directory and be linked together.
+    // Files that already exist are left alone, so a build can compile only
+    // new hashes and reuse the other objects. Panics if a file can't be
+    // written.
+    FunctionCache stream_function_cache(const std::string& directory);
+
+    // Drops private/internal functions and globals, and declarations, that
+    // can't be reached through calls or @global references from a root: any
+    // other function or global, or one named in `roots`. Linear in the size
+    // of the module; reached functions with a body producer are produced
+    // once to be scanned. Intrinsics a producer declares then are kept if its
+    // body calls them; a producer that adds functions or globals panics.
+    Module& prune(const Vec<std::string>& roots = {});
+};
+
+template <> std::string generate<Module>(Module);
+
 } // namespace LLVM
 
 #endif // LLVM_H
@@ -0,0 +1,157 @@
+#include <string>
+#include "llvm.hpp"
+#include "check.hpp"
+using namespace LLVM;
+
+static Instruction br(const std::string& dest) { return Instruction::from(Instruction::Br(dest)); }
+static Instruction cond_br(const std::string& t, const std::string& f) {
+    return Instruction::from(Instruction::Br(Constant::Boolean(true), t, f));
+}
+static Instruction ret() { return Instruction::from(Instruction::Ret(*Type::Integer(), Constant::Integer(0))); }
+
+static usz index(Function& fn, const std::string& name) { return fn.cfg.index_of(name).value(); }
+
+static void dominators() {
+    // a -> b; b -> c | d; c -> e; d -> e | b; e returns; dead -> e is unreachable.
+    auto fn = Function::create("f", *Type::Integer())
+        .add_basic_block(BasicBlock::create("a").add_instruction(br("b")))
+        .add_basic_block(BasicBlock::create("b").add_instruction(cond_br("c", "d")))
+        .add_basic_block(BasicBlock::create("c").add_instruction(br("e")))
+        .add_basic_block(BasicBlock::create("d").add_instruction(cond_br("e", "b")))
+        .add_basic_block(BasicBlock::create("e").add_instruction(ret()))
+        .add_basic_block(BasicBlock::create("dead").add_instruction(br("e")));
+    fn.verify();
+    auto& cfg = fn.cfg;
+    usz a = index(fn, "a"), b = index(fn, "b"), c = index(fn, "c"), d = index(fn, "d"),
+        e = index(fn, "e"), dead = index(fn, "dead");
+
+    CHECK(!cfg.immediate_dominator(a).has_value());
+    CHECK(cfg.immediate_dominator(b) == a);
+    CHECK(cfg.immediate_dominator(c) == b);
+    CHECK(cfg.immediate_dominator(d) == b);
+    CHECK(cfg.immediate_dominator(e) == b);
+    CHECK(!cfg.immediate_dominator(dead).has_value());
+
+    CHECK(cfg.dominates(a, e) && cfg.dominates(b, e) && cfg.dominates(e, e));
+    CHECK(!cfg.dominates(c, e) && !cfg.dominates(d, e));
+    CHECK(!cfg.dominates(a, dead) && !cfg.dominates(dead, e));
+    CHECK(cfg.predecessors(e).size() == 3);
+    CHECK(cfg.predecessors(b).size() == 2);
+}
+
+static void placeholders() {
+    // `later` is branched to before it is defined.
+    auto fn = Function::create("f", *Type::Integer())
+        .add_basic_block(BasicBlock::create("entry").add_instruction(br("later")));
+    usz later = index(fn, "later");
+    CHECK(!fn.cfg.nodes.at(later).defined);
+    CHECK(fn.cfg.predecessors(later).size() == 1);
+    CHECK(fn.cfg.immediate_dominator(later) == index(fn, "entry"));
+
+    fn.add_basic_block(BasicBlock::create("later").add_instruction(ret()));
+    CHECK(fn.cfg.nodes.at(later).defined);
+    CHECK(fn.cfg.index_of("later") == later);
+    fn.verify();
+}
+
+static void late_terminators() {
+    auto phi = Instruction::from(Instruction::Phi(*Type::Integer())
+        ->add_incoming({Constant::Integer(0), "entry"})).set_name("x");
+
+    // Through Function::add_instruction, which refolds incrementally.
+    auto fn = Function::create("f", *Type::Integer())
+        .add_basic_block(BasicBlock::create("entry"))
+        .add_basic_block(BasicBlock::create("exit").add_instruction(phi).add_instruction(ret()));
+    CHECK(fn.cfg.predecessors(index(fn, "exit")).empty());
+    fn.add_instruction("entry", br("exit"));
+    CHECK(fn.cfg.predecessors(index(fn, "exit")).size() == 1);
+    CHECK(fn.cfg.immediate_dominator(index(fn, "exit")) == index(fn, "entry"));
+    fn.verify();
+
+    // Replacing a terminator drops its old edges.
+    fn.body.front().instructions.back() = br("other");
+    fn.add_basic_block(BasicBlock::create("other").add_instruction(br("exit")));
+    fn.cfg.refresh(fn.body);
+    CHECK(fn.cfg.predecessors(index(fn, "exit")) == Vec<usz>{index(fn, "other")});
+
+    // Edited directly through `body`; verify picks it up.
+    auto direct = Function::create("g", *Type::Integer())
+        .add_basic_block(BasicBlock::create("entry"))
+        .add_basic_block(BasicBlock::create("exit").add_instruction(phi).add_instruction(ret()));
+    direct.body.front().add_instruction(br("exit"));
+    direct.verify();
+    CHECK(direct.cfg.predecessors(index(direct, "exit")).size() == 1);
+}
+
+static void phi_multi_edges() {
+    // Two switch cases to the same block are two edges, so two equal entries.
+    auto i32 = *Type::Integer();
+    auto fn = Function::create("f", i32)
+        .add_basic_block(BasicBlock::create("entry")
+            .add_instruction(Instruction::from(Instruction::Switch(i32, Constant::Integer(0), "exit")
+                ->add_case({Constant::Integer(1), "exit"}))))
+        .add_basic_block(BasicBlock::create("exit")
+            .add_instruction(Instruction::from(Instruction::Phi(i32)
+                ->add_incoming({Constant::Integer(7), "entry"})
+                ->add_incoming({Constant::Integer(7), "entry"})).set_name("x"))
+            .add_instruction(ret()));
+    fn.verify();
+}
+
+// Must panic: one edge from `a` into `b`, but the phi gives it two values.
+static void phi_conflicting_values() {
+    auto i32 = *Type::Integer();
+    auto fn = Function::create("f", i32)
+        .add_basic_block(BasicBlock::create("a").add_instruction(Instruction::from(
+            Instruction::Switch(i32, Constant::Integer(0), "b")->add_case({Constant::Integer(1), "b"}))))
+        .add_basic_block(BasicBlock::create("b")
+            .add_instruction(Instruction::from(Instruction::Phi(i32)
+                ->add_incoming({Constant::Integer(1), "a"})
+                ->add_incoming({Constant::Integer(2), "a"})).set_name("x"))
+            .add_instruction(ret()));
+    fn.verify();
+}
+
+// Must panic: `a` already ends in `br label %b`.
+static void append_after_terminator() {
+    auto fn = Function::create("f", *Type::Integer())
+        .add_basic_block(BasicBlock::create("a").add_instruction(br("b")))
+        .add_basic_block(BasicBlock::create("b").add_instruction(ret()));
+    fn.add_instruction("a", ret());
+}
+
+// Must panic: the phi follows a call.
+static void phi_after_non_phi() {
+    auto i32 = *Type::Integer();
+    auto fn = Function::create("f", i32)
+        .add_basic_block(BasicBlock::create("a").add_instruction(br("b")))
+        .add_basic_block(BasicBlock::create("b")
+            .add_instruction(Instruction::from(Instruction::Call(i32, "g")))
+            .add_instruction(Instruction::from(Instruction::Phi(i32)->add_incoming({Constant::Integer(1), "a"})).set_name("x"))
+            .add_instruction(ret()));
+    fn.verify();
+}
+
+// Must panic: `a` returns before its last instruction.
+static void early_terminator() {
+    auto fn = Function::create("f", *Type::Integer())
+        .add_basic_block(BasicBlock::create("a").add_instruction(ret()).add_instruction(br("b")))
+        .add_basic_block(BasicBlock::create("b").add_instruction(ret()));
+    fn.verify();
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        std::string name = argv[1];
+        if (name == "phi-conflicting-values") phi_conflicting_values();
+        if (name == "append-after-terminator") append_after_terminator();
+        if (name == "phi-after-non-phi") phi_after_non_phi();
+        if (name == "early-terminator") early_terminator();
+        return 0;
+    }
+    dominators();
+    placeholders();
+    late_terminators();
+    phi_multi_edges();
+    return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef LLVM_TESTS_CHECK_H
+#define LLVM_TESTS_CHECK_H
+
+#include <cstdio>
+#include <cstdlib>
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            std::exit(1);                                                        \
+        }                                                                        \
+    } while (0)
+
+#endif // LLVM_TESTS_CHECK_H
@@ -0,0 +1,115 @@
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <limits>
+#include <string>
+#include "llvm.hpp"
+#include "check.hpp"
+using namespace LLVM;
+
+// The float LLVM reads back from `float 0x<16 hex digits>`.
+static std::uint32_t parsed_float_bits(const std::string& hex) {
+    auto bits = std::strtoull(hex.c_str(), nullptr, 16);
+    auto value = std::bit_cast<double>(static_cast<std::uint64_t>(bits));
+    if (value != value) {
+        // NaNs keep the top of the mantissa, signaling or not.
+        CHECK((bits & ((1ull << 29) - 1)) == 0);
+        return static_cast<std::uint32_t>(bits >> 63 << 31) | 0x7f800000u | static_cast<std::uint32_t>((bits >> 29) & 0x7fffff);
+    }
+    // Everything else is exactly representable, so this conversion is exact.
+    auto narrowed = static_cast<float>(value);
+    CHECK(static_cast<double>(narrowed) == value);
+    return std::bit_cast<std::uint32_t>(narrowed);
+}
+
+static void float_round_trip() {
+    Vec<std::uint32_t> patterns{
+        0x00000000, 0x80000000, 0x3f800000, 0xbf800000, // ±0, ±1
+        0x00000001, 0x807fffff, 0x00400000,             // subnormals
+        0x7f7fffff, 0x00800000,                         // largest, smallest normal
+        0x7f800000, 0xff800000,                         // ±inf
+        0x7f800001, 0xffbfffff, 0x7fc00000, 0x7fc00001, // signaling and quiet NaNs
+    };
+    std::mt19937 rng(7);
+    for (int i = 0; i < 10000; i++) patterns.push_back(static_cast<std::uint32_t>(rng()));
+
+    Vec<float> values;
+    for (auto bits : patterns) values.push_back(std::bit_cast<float>(bits));
+    auto text = generate<Constant>(Constant::Array(std::span<const float>(values)));
+
+    usz at = 0;
+    for (auto bits : patterns) {
+        at = text.find("float 0x", at);
+        CHECK(at != std::string::npos);
+        at += 8;
+        CHECK(parsed_float_bits(text.substr(at, 16)) == bits);
+    }
+    // A signaling NaN stays signaling.
+    float snan = std::bit_cast<float>(0x7f800001u);
+    CHECK(generate<Constant>(Constant::Array(std::span<const float>(&snan, 1))) == "[float 0x7FF0000020000000]");
+}
+
+template <typename T> static std::string table(const Vec<T>& values) {
+    return generate<Constant>(Constant::Array(std::span<const T>(values)));
+}
+
+static void tables() {
+    CHECK(table(Vec<std::int16_t>{1, -2, std::numeric_limits<std::int16_t>::min()}) == "[i16 1, i16 -2, i16 -32768]");
+    CHECK(table(Vec<std::int32_t>{0, std::numeric_limits<std::int32_t>::max()}) == "[i32 0, i32 2147483647]");
+    CHECK(table(Vec<std::int64_t>{std::numeric_limits<std::int64_t>::min(), 3}) == "[i64 -9223372036854775808, i64 3]");
+    CHECK(table(Vec<float>{1.0f, -0.5f}) == "[float 0x3FF0000000000000, float 0xBFE0000000000000]");
+    CHECK(table(Vec<double>{0.1, -0.0}) == "[double 0x3FB999999999999A, double 0x8000000000000000]");
+    CHECK(table(Vec<std::uint8_t>{'o', 'k', 0}) == "c\"ok\\00\"");
+
+    // All-zero and empty tables.
+    CHECK(table(Vec<std::int32_t>(1000, 0)) == "zeroinitializer");
+    CHECK(table(Vec<double>{0.0, 0.0}) == "zeroinitializer");
+    CHECK(table(Vec<std::int64_t>{}) == "zeroinitializer");
+    // -0.0 isn't all-zero bits.
+    CHECK(table(Vec<double>{-0.0}) == "[double 0x8000000000000000]");
+}
+
+// Long enough to be written through the formatting buffer many times over.
+static void long_table() {
+    Vec<std::int64_t> values;
+    std::string expected = "[";
+    for (std::int64_t i = 0; i < 50000; i++) {
+        values.push_back(i * -1000003 - 7);
+        if (i > 0) expected += ", ";
+        expected += "i64 " + std::to_string(values.back());
+    }
+    expected += "]";
+    CHECK(expected.size() > 4 * 65536);
+    CHECK(table(values) == expected);
+
+    Vec<double> doubles(20000, 1.0);
+    auto text = table(doubles);
+    CHECK(text.size() == 1 + 20000 * std::string("double 0x3FF0000000000000").size() + 19999 * 2 + 1);
+    CHECK(text.ends_with(", double 0x3FF0000000000000]"));
+}
+
+static void aggregates() {
+    auto i32 = *Type::Integer(), i8p = *Type::Pointer(Type::Integer(8));
+    CHECK(generate<Constant>(Constant::Array({{i32, Constant::Integer(1)}, {i32, Constant::Integer(-2)}})) == "[i32 1, i32 -2]");
+    CHECK(generate<Constant>(Constant::Vector({{i32, Constant::Integer(1)}, {i32, Constant::Integer(2)}})) == "<i32 1, i32 2>");
+    CHECK(generate<Constant>(Constant::Struct({{i32, Constant::Integer(1)}, {i8p, Constant::Null()},
+                                               {i8p, Constant::GlobalVariable("g")}})) == "{ i32 1, i8* null, i8* @g }");
+    CHECK(generate<Constant>(Constant::Array(Vec<Constant::Element>{})) == "[]");
+
+    // Nested, with a packed table as an element.
+    Vec<std::int16_t> pair{4, 5};
+    auto inner = Constant::Struct({{i32, Constant::Integer(3)},
+                                   {*Type::Array(Type::Integer(16), 2), Constant::Array(std::span<const std::int16_t>(pair))}});
+    auto row = *Type::Structure({i32, *Type::Array(Type::Integer(16), 2)});
+    CHECK(generate<Constant>(Constant::Array({{row, inner}, {row, Constant::ZeroInitializer()}}))
+          == "[{ i32, [2 x i16] } { i32 3, [2 x i16] [i16 4, i16 5] }, { i32, [2 x i16] } zeroinitializer]");
+}
+
+int main() {
+    float_round_trip();
+    tables();
+    long_table();
+    aggregates();
+    return 0;
+}
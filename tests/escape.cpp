@@ -0,0 +1,70 @@
+#include <cstdint>
+#include <random>
+#include <string>
+#include "llvm.hpp"
+#include "check.hpp"
+using namespace LLVM;
+
+// Byte-at-a-time reference for the c"..." escaping rules.
+static std::string reference(const std::string& bytes) {
+    static constexpr char hex[] = "0123456789ABCDEF";
+    std::string out;
+    for (unsigned char c : bytes) {
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+            out += static_cast<char>(c);
+        } else {
+            out += '\\';
+            out += hex[c >> 4];
+            out += hex[c & 0xf];
+        }
+    }
+    return out;
+}
+
+static void check_escaped(const std::string& bytes) {
+    auto escaped = reference(bytes);
+    CHECK(generate<Constant>(Constant::String(bytes)) == "c\"" + escaped + "\"");
+    CHECK(MetadataTable::string(bytes) == "!\"" + escaped + "\"");
+}
+
+// Every byte value at every position of buffers either side of the 16-byte
+// chunks the vector scanner reads.
+static void every_byte_at_every_position() {
+    for (usz size = 0; size <= 48; size++) {
+        std::string printable(size, 'a');
+        check_escaped(printable);
+        for (usz position = 0; position < size; position++) {
+            for (int c = 0; c < 256; c++) {
+                auto bytes = printable;
+                bytes[position] = static_cast<char>(c);
+                check_escaped(bytes);
+            }
+        }
+    }
+}
+
+static void random_buffers() {
+    std::mt19937 rng(12345);
+    for (int round = 0; round < 2000; round++) {
+        std::string bytes(rng() % 200, '\0');
+        // Mostly printable, so long runs cross chunk boundaries.
+        for (auto& c : bytes)
+            c = static_cast<char>(rng() % 8 == 0 ? rng() % 256 : 0x20 + rng() % 0x5f);
+        check_escaped(bytes);
+    }
+}
+
+// i8 tables share the same path.
+static void byte_tables() {
+    std::string bytes;
+    for (int c = 0; c < 256; c++) bytes += static_cast<char>(c);
+    std::span<const std::int8_t> values(reinterpret_cast<const std::int8_t *>(bytes.data()), bytes.size());
+    CHECK(generate<Constant>(Constant::Array(values)) == "c\"" + reference(bytes) + "\"");
+}
+
+int main() {
+    every_byte_at_every_position();
+    random_buffers();
+    byte_tables();
+    return 0;
+}
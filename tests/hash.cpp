@@ -0,0 +1,150 @@
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include "llvm.hpp"
+#include "check.hpp"
+using namespace LLVM;
+
+struct Variant {
+    int callee_result = 0;
+    usz callee_parameter_size = 32;
+    bool unrelated_metadata_first = false;
+    Opt<DLLStorageClass> puts_storage_class = None;
+    std::string module_name = "test";
+};
+
+// @msg (internal), @callee (internal), @main calling @callee and @puts with
+// @msg, with a loop ID on a branch and an entry count on @main.
+static Module build(Variant variant) {
+    auto i32 = *Type::Integer(), parameter = *Type::Integer(variant.callee_parameter_size);
+    auto message = *Type::Array(Type::Integer(8), 3);
+    Module m;
+    m.name = variant.module_name;
+    if (variant.unrelated_metadata_first) m.metadata.loop_property("unrelated");
+    auto loop = m.metadata.loop({m.metadata.loop_unroll_count(4)});
+    auto entry_count = m.metadata.function_entry_count(10);
+
+    m.add_global_variable(GlobalVariable::create("msg", message, Constant::String(std::string("hi", 3)))
+            .set_linkage(Linkage::Internal));
+    auto puts = ExternalFunction::create("puts", i32).add_parameter({*Type::Pointer(Type::Integer(8))});
+    puts.dll_storage_class = variant.puts_storage_class;
+    m.add_external_function(puts);
+    auto callee = Function::create("callee", i32)
+            .add_parameter({parameter, std::string("x")})
+            .add_basic_block(BasicBlock::create("entry")
+                    .add_instruction(Instruction::from(Instruction::Ret(i32, Constant::Integer(variant.callee_result)))));
+    callee.linkage = Linkage::Internal;
+    m.add_function(callee);
+    m.add_function(Function::create("main", i32)
+            .add_metadata("prof", entry_count)
+            .add_basic_block(BasicBlock::create("entry")
+                    .add_instruction(Instruction::from(Instruction::GetElementPtr(message, *Type::Pointer(Type::Array(Type::Integer(8), 3)),
+                                                                                  Constant::GlobalVariable("msg"))).set_name("p"))
+                    .add_instruction(Instruction::from(Instruction::Call(i32, "puts")
+                            ->add_argument({*Type::Pointer(Type::Integer(8)), Constant::LocalVariable("p")})))
+                    .add_instruction(Instruction::from(Instruction::Call(i32, "callee")
+                            ->add_argument({parameter, Constant::Integer(1)})).set_name("r"))
+                    .add_instruction(Instruction::from(Instruction::Br("exit")).add_metadata("llvm.loop", loop)))
+            .add_basic_block(BasicBlock::create("exit")
+                    .add_instruction(Instruction::from(Instruction::Ret(i32, Constant::LocalVariable("r"))))));
+    return m;
+}
+
+static void stability() {
+    auto hashes = build({}).function_hashes();
+    CHECK(hashes.size() == 2);
+    CHECK(hashes[0] != hashes[1]);
+    CHECK(build({}).function_hashes() == hashes);
+    // Metadata indices shift, its content doesn't.
+    CHECK(build({.unrelated_metadata_first = true}).function_hashes() == hashes);
+}
+
+static void sensitivity() {
+    auto hashes = build({}).function_hashes();
+    // A callee's body isn't part of its callers' hashes, its signature is.
+    auto body = build({.callee_result = 1}).function_hashes();
+    CHECK(body[0] != hashes[0]);
+    CHECK(body[1] == hashes[1]);
+    auto signature = build({.callee_parameter_size = 64}).function_hashes();
+    CHECK(signature[0] != hashes[0]);
+    CHECK(signature[1] != hashes[1]);
+    // Anything the written declaration of a callee shows counts.
+    auto declaration = build({.puts_storage_class = DLLStorageClass::DLLImport}).function_hashes();
+    CHECK(declaration[0] == hashes[0]);
+    CHECK(declaration[1] != hashes[1]);
+}
+
+static std::string read(const std::filesystem::path& path) {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// The one definition in `text` of a function or global named `name` or
+// `name.<suffix>`.
+static std::string defined_name(const std::string& text, const std::string& prefix, const std::string& name) {
+    auto start = text.find(prefix + name + ".");
+    CHECK(start != std::string::npos);
+    start += prefix.size();
+    return text.substr(start, text.find_first_of("( ", start) - start);
+}
+
+static void cache() {
+    auto directory = std::filesystem::temp_directory_path() / ("llvm-hpp-cache-" + std::to_string(std::random_device{}()));
+    std::filesystem::remove_all(directory);
+    auto name = [&](const char *prefix, std::uint64_t hash) {
+        char file[64];
+        std::snprintf(file, sizeof(file), "%s%016llx.ll", prefix, static_cast<unsigned long long>(hash));
+        return directory / file;
+    };
+
+    auto module = build({});
+    auto cache = module.stream_function_cache(directory.string());
+    CHECK(cache.function_hashes == module.function_hashes());
+    CHECK(cache.globals_hash.has_value());
+
+    // Internal symbols are defined external, hidden and renamed after the
+    // module, and declared and referenced the same way, so the files link.
+    auto callee = read(name("", cache.function_hashes[0]));
+    auto main = read(name("", cache.function_hashes[1]));
+    auto globals = read(name("globals-", cache.globals_hash.value()));
+    auto callee_name = defined_name(callee, "define hidden i32 @", "callee");
+    auto msg_name = defined_name(globals, "@", "msg");
+    CHECK(globals.find("@" + msg_name + " = hidden constant [3 x i8] c\"hi\\00\"") != std::string::npos);
+    CHECK(globals.find("internal") == std::string::npos);
+    CHECK(main.find("@" + msg_name + " = external hidden constant [3 x i8]") != std::string::npos);
+    CHECK(main.find("[3 x i8]* @" + msg_name + ",") != std::string::npos);
+    CHECK(main.find("declare hidden i32 @" + callee_name + "(") != std::string::npos);
+    CHECK(main.find("call i32 @" + callee_name + "(") != std::string::npos);
+    CHECK(main.find("declare i32 @puts(") != std::string::npos);
+    CHECK(main.find("!llvm.loop !") != std::string::npos);
+
+    // Another module's locals of the same name get other names, so both
+    // modules' objects can be linked into one binary.
+    auto other = build({.callee_result = 1, .module_name = "other"}).stream_function_cache(directory.string());
+    auto other_callee = read(name("", other.function_hashes[0]));
+    auto other_globals = read(name("globals-", other.globals_hash.value()));
+    CHECK(defined_name(other_callee, "define hidden i32 @", "callee") != callee_name);
+    CHECK(defined_name(other_globals, "@", "msg") != msg_name);
+    CHECK(other.function_hashes[1] != cache.function_hashes[1]);
+
+    // Writing again reuses every file and leaves no temporaries behind.
+    CHECK(build({}).stream_function_cache(directory.string()).globals_hash == cache.globals_hash);
+    usz files = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        CHECK(entry.path().extension() == ".ll");
+        files++;
+    }
+    CHECK(files == 6);
+    std::filesystem::remove_all(directory);
+}
+
+int main() {
+    stability();
+    sensitivity();
+    cache();
+    return 0;
+}
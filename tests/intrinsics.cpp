@@ -0,0 +1,82 @@
+#include <string>
+#include "llvm.hpp"
+#include "check.hpp"
+using namespace LLVM;
+
+using Reduction = Intrinsic::VectorReduction;
+
+static std::string declared(const Intrinsic& intrinsic) { return generate<ExternalFunction>(intrinsic.declaration()); }
+
+static void catalog() {
+    auto i8p = *Type::Pointer(Type::Integer(8)), i64 = *Type::Integer(64), i32 = *Type::Integer();
+    auto floats = *Type::Vector(Type::Float(), 4);
+    CHECK(declared(Intrinsic::Memcpy(i8p, i8p, i64)) == "declare void @llvm.memcpy.p0i8.p0i8.i64(i8*, i8*, i64, i1)");
+    CHECK(declared(Intrinsic::Memmove(i8p, i8p, i32)) == "declare void @llvm.memmove.p0i8.p0i8.i32(i8*, i8*, i32, i1)");
+    CHECK(declared(Intrinsic::Memset(i8p, i64)) == "declare void @llvm.memset.p0i8.i64(i8*, i8, i64, i1)");
+    CHECK(declared(Intrinsic::Prefetch(i8p)) == "declare void @llvm.prefetch.p0i8(i8*, i32, i32, i32)");
+    CHECK(declared(Intrinsic::Expect(*Type::Integer(1))) == "declare i1 @llvm.expect.i1(i1, i1)");
+    CHECK(declared(Intrinsic::Assume()) == "declare void @llvm.assume(i1)");
+    CHECK(declared(Intrinsic::LifetimeStart(i8p)) == "declare void @llvm.lifetime.start.p0i8(i64, i8*)");
+    CHECK(declared(Intrinsic::LifetimeEnd(i8p)) == "declare void @llvm.lifetime.end.p0i8(i64, i8*)");
+    CHECK(declared(Intrinsic::Ctpop(i32)) == "declare i32 @llvm.ctpop.i32(i32)");
+    CHECK(declared(Intrinsic::Ctlz(i64)) == "declare i64 @llvm.ctlz.i64(i64, i1)");
+    CHECK(declared(Intrinsic::Cttz(*Type::Vector(Type::Integer(8), 16))) == "declare <16 x i8> @llvm.cttz.v16i8(<16 x i8>, i1)");
+    CHECK(declared(Intrinsic::Fma(*Type::Double())) == "declare double @llvm.fma.f64(double, double, double)");
+    // The ordered floating point reductions take a start value first.
+    CHECK(declared(Intrinsic::VectorReduce(Reduction::Fadd, floats)) == "declare float @llvm.vector.reduce.fadd.v4f32(float, <4 x float>)");
+    CHECK(declared(Intrinsic::VectorReduce(Reduction::Fmul, floats)) == "declare float @llvm.vector.reduce.fmul.v4f32(float, <4 x float>)");
+    CHECK(declared(Intrinsic::VectorReduce(Reduction::Fmax, floats)) == "declare float @llvm.vector.reduce.fmax.v4f32(<4 x float>)");
+
+    CHECK(generate<Instruction>(Instruction::from(Intrinsic::Ctlz(i64).call({Constant::LocalVariable("x"), Constant::Boolean(false)})))
+          .find("call i64 @llvm.ctlz.i64(i64 %x, i1 false)") != std::string::npos);
+}
+
+static void declared_once() {
+    auto i32 = *Type::Integer();
+    Module m;
+    m.call_intrinsic(Intrinsic::Ctpop(i32), {Constant::Integer(1)});
+    m.call_intrinsic(Intrinsic::Ctpop(i32), {Constant::Integer(2)});
+    m.call_intrinsic(Intrinsic::Ctpop(*Type::Integer(64)), {Constant::Integer(3)});
+    CHECK(m.external_functions.size() == 2);
+    CHECK(m.external_functions[0].function_name == "llvm.ctpop.i32");
+    CHECK(m.external_functions[1].function_name == "llvm.ctpop.i64");
+}
+
+// Must panic: memset takes four arguments.
+static void wrong_argument_count() {
+    Intrinsic::Memset(*Type::Pointer(Type::Integer(8)), *Type::Integer(64)).call({Constant::Null(), Constant::Integer(0)});
+}
+
+static void reduction_types() {
+    auto floats = *Type::Vector(Type::Double(), 2), integers = *Type::Vector(Type::Integer(16), 8);
+    for (auto reduction : {Reduction::Fadd, Reduction::Fmul, Reduction::Fmax, Reduction::Fmin})
+        CHECK(Intrinsic::VectorReduce(reduction, floats).return_type.kind == Type::Kind::Double);
+    for (auto reduction : {Reduction::Add, Reduction::Mul, Reduction::And, Reduction::Or, Reduction::Xor,
+                           Reduction::Smax, Reduction::Smin, Reduction::Umax, Reduction::Umin})
+        CHECK(Intrinsic::VectorReduce(reduction, integers).return_type.kind == Type::Kind::Integer);
+    CHECK(declared(Intrinsic::VectorReduce(Reduction::Smax, integers)) == "declare i16 @llvm.vector.reduce.smax.v8i16(<8 x i16>)");
+}
+
+// Must panic: an integer reduction on floats.
+static void integer_reduction_on_floats() {
+    Intrinsic::VectorReduce(Reduction::Add, *Type::Vector(Type::Float(), 4));
+}
+
+// Must panic: a floating point reduction on integers.
+static void fadd_on_integers() {
+    Intrinsic::VectorReduce(Reduction::Fadd, *Type::Vector(Type::Integer(), 4));
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        std::string name = argv[1];
+        if (name == "integer-reduction-on-floats") integer_reduction_on_floats();
+        if (name == "fadd-on-integers") fadd_on_integers();
+        if (name == "wrong-argument-count") wrong_argument_count();
+        return 0;
+    }
+    catalog();
+    declared_once();
+    reduction_types();
+    return 0;
+}
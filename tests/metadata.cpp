@@ -0,0 +1,122 @@
+#include <sstream>
+#include <string>
+#include "llvm.hpp"
+#include "check.hpp"
+using namespace LLVM;
+
+static Instruction ret() { return Instruction::from(Instruction::Ret(*Type::Integer(), Constant::Integer(0))); }
+
+// A conditional branch from `entry` to `a` or `b`, weighted with `weights`.
+static Function weighted_branch(MetadataTable& metadata, const Vec<usz>& weights) {
+    return Function::create("f", *Type::Integer())
+        .add_basic_block(BasicBlock::create("entry")
+            .add_instruction(Instruction::from(Instruction::Br(Constant::Boolean(true), "a", "b"))
+                .add_metadata("prof", metadata.branch_weights(weights))))
+        .add_basic_block(BasicBlock::create("a").add_instruction(ret()))
+        .add_basic_block(BasicBlock::create("b").add_instruction(ret()));
+}
+
+static void uniquing() {
+    MetadataTable metadata;
+    usz a = metadata.node({MetadataTable::string("a")});
+    usz b = metadata.node({MetadataTable::string("b")});
+    CHECK(a != b);
+    CHECK(metadata.node({MetadataTable::string("a")}) == a);
+    CHECK(metadata.branch_weights({1, 2}) == metadata.branch_weights({1, 2}));
+    CHECK(metadata.loop_unroll_count(4) == metadata.loop_unroll_count(4));
+    CHECK(metadata.nodes.size() == 4);
+
+    // Strings are escaped like c"..." strings.
+    CHECK(metadata.nodes.at(metadata.node({MetadataTable::string("q\"\\\n")})) == "!{!\"q\\22\\5C\\0A\"}");
+}
+
+static void loop_ids() {
+    MetadataTable metadata;
+    usz width = metadata.loop_vectorize_width(8);
+    usz first = metadata.loop({width});
+    usz second = metadata.loop({width});
+    // Distinct, so two loops never share an ID even with the same properties.
+    CHECK(first != second);
+    auto self = MetadataTable::reference(first);
+    CHECK(metadata.nodes.at(first) == "distinct !{" + self + ", " + MetadataTable::reference(width) + "}");
+    CHECK(metadata.nodes.at(width) == "!{!\"llvm.loop.vectorize.width\", i32 8}");
+}
+
+// Attachments print as `, !kind !N` on instructions and globals and before
+// the body on functions; the nodes themselves come once, after everything
+// else in the module.
+static void attachments() {
+    Module m;
+    usz annotation = m.metadata.node({MetadataTable::string("table")});
+    usz loop = m.metadata.loop({m.metadata.loop_unroll_count(2)});
+    usz entry_count = m.metadata.function_entry_count(7);
+    m.add_global_variable(GlobalVariable::create("g", *Type::Integer(), Constant::Integer(1))
+        .add_metadata("annotation", annotation));
+    m.add_function(Function::create("f", *Type::Integer())
+        .add_metadata("prof", entry_count)
+        .add_basic_block(BasicBlock::create("entry").add_instruction(Instruction::from(Instruction::Br("body"))))
+        .add_basic_block(BasicBlock::create("body")
+            .add_instruction(Instruction::from(Instruction::Br("body")).add_metadata("llvm.loop", loop))));
+    m.add_external_function(ExternalFunction::create("puts", *Type::Integer()));
+
+    std::stringstream ss;
+    m.stream(ss);
+    auto text = ss.str();
+    auto ref = MetadataTable::reference;
+    CHECK(text.find("@g = constant i32 1, !annotation " + ref(annotation) + "\n") != std::string::npos);
+    CHECK(text.find("define i32 @f() !prof " + ref(entry_count) + " {") != std::string::npos);
+    CHECK(text.find("br label %body, !llvm.loop " + ref(loop) + "\n") != std::string::npos);
+
+    auto block = text.find("\n!0 = ");
+    CHECK(block != std::string::npos);
+    CHECK(block > text.find("declare i32 @puts()"));
+    for (usz node = 0; node < m.metadata.nodes.size(); node++) {
+        auto line = "\n" + ref(node) + " = " + m.metadata.nodes.at(node) + "\n";
+        auto at = text.find(line);
+        CHECK(at != std::string::npos && at >= block);
+        CHECK(text.find(line, at + 1) == std::string::npos);
+    }
+}
+
+static void branch_weights() {
+    MetadataTable metadata;
+    usz small = metadata.branch_weights({3, 1});
+    CHECK(metadata.nodes.at(small) == "!{!\"branch_weights\", i32 3, i32 1}");
+
+    // Raw profile counts are scaled into i32, keeping their ratio.
+    usz large = metadata.branch_weights({5000000000, 1250000000});
+    CHECK(metadata.nodes.at(large) == "!{!\"branch_weights\", i32 2500000000, i32 625000000}");
+    usz limit = metadata.branch_weights({UINT32_MAX, 0});
+    CHECK(metadata.nodes.at(limit) == "!{!\"branch_weights\", i32 4294967295, i32 0}");
+    usz past_limit = metadata.branch_weights({usz{UINT32_MAX} + 1, 2});
+    CHECK(metadata.nodes.at(past_limit) == "!{!\"branch_weights\", i32 2147483648, i32 1}");
+
+    weighted_branch(metadata, {3, 1}).verify(metadata);
+
+    auto sw = Instruction::Switch(*Type::Integer(), Constant::Integer(0), "a");
+    sw->add_case({Constant::Integer(1), "b"});
+    Function::create("g", *Type::Integer())
+        .add_basic_block(BasicBlock::create("entry")
+            .add_instruction(Instruction::from(sw).add_metadata("prof", metadata.branch_weights({1, 2}))))
+        .add_basic_block(BasicBlock::create("a").add_instruction(ret()))
+        .add_basic_block(BasicBlock::create("b").add_instruction(ret()))
+        .verify(metadata);
+}
+
+// One weight too many for a conditional branch.
+static void weight_count_mismatch() {
+    MetadataTable metadata;
+    weighted_branch(metadata, {1, 2, 3}).verify(metadata);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "weight-count-mismatch") {
+        weight_count_mismatch();
+        return 0;
+    }
+    uniquing();
+    loop_ids();
+    attachments();
+    branch_weights();
+    return 0;
+}
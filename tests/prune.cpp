@@ -0,0 +1,100 @@
+#include <string>
+#include "llvm.hpp"
+#include "check.hpp"
+using namespace LLVM;
+
+static Function function(const std::string& name, Opt<Linkage> linkage, const Vec<std::string>& callees) {
+    auto bb = BasicBlock::create("entry");
+    for (const auto& callee : callees)
+        bb = bb.add_instruction(Instruction::from(Instruction::Call(*Type::Integer(), callee)));
+    auto fn = Function::create(name, *Type::Integer())
+            .add_basic_block(bb.add_instruction(Instruction::from(Instruction::Ret(*Type::Integer(), Constant::Integer(0)))));
+    fn.linkage = linkage;
+    return fn;
+}
+
+template <typename T, typename N> static bool has(const Vec<T>& symbols, const std::string& name, N name_of) {
+    for (const auto& symbol : symbols)
+        if (name_of(symbol) == name) return true;
+    return false;
+}
+static bool has_function(const Module& m, const std::string& name) {
+    return has(m.functions, name, [](const Function& fn) { return fn.function_name; });
+}
+static bool has_declaration(const Module& m, const std::string& name) {
+    return has(m.external_functions, name, [](const ExternalFunction& fn) { return fn.function_name; });
+}
+static bool has_global(const Module& m, const std::string& name) {
+    return has(m.global_variables, name, [](const GlobalVariable& var) { return var.global_var_name; });
+}
+
+static void reachability() {
+    auto bytes = *Type::Array(Type::Integer(8), 3);
+    Module m;
+    m.add_global_variable(GlobalVariable::create("used", bytes, Constant::String(std::string("hi", 3)))
+            .set_linkage(Linkage::Private));
+    m.add_global_variable(GlobalVariable::create("dead", bytes, Constant::String(std::string("no", 3)))
+            .set_linkage(Linkage::Private));
+    m.add_global_variable(GlobalVariable::create("table", *Type::Pointer(Type::Integer(8)), Constant::GlobalVariable("dead"))
+            .set_linkage(Linkage::Internal));
+    m.add_external_function(ExternalFunction::create("puts", *Type::Integer()));
+    m.add_external_function(ExternalFunction::create("unused", *Type::Integer()));
+    auto main = function("main", None, {"helper", "puts"});
+    auto& instructions = main.body.front().instructions;
+    instructions.insert(instructions.begin(), Instruction::from(Instruction::GetElementPtr(
+            bytes, *Type::Pointer(Type::Array(Type::Integer(8), 3)), Constant::GlobalVariable("used"))).set_name("p"));
+    m.add_function(main);
+    m.add_function(function("helper", Linkage::Internal, {}));
+    m.add_function(function("dead_helper", Linkage::Internal, {"unused"}));
+    m.add_function(function("rooted", Linkage::Private, {}));
+    m.prune({"rooted"});
+
+    CHECK(has_function(m, "main") && has_function(m, "helper") && has_function(m, "rooted"));
+    CHECK(!has_function(m, "dead_helper"));
+    CHECK(has_declaration(m, "puts") && !has_declaration(m, "unused"));
+    CHECK(has_global(m, "used"));
+    CHECK(!has_global(m, "dead") && !has_global(m, "table"));
+}
+
+// Intrinsics a producer declares while being scanned are indexed, so they
+// stay exactly when a body calls them.
+static void producer_declarations() {
+    auto i64 = *Type::Integer(64);
+    Module m;
+    m.add_function(function("main", None, {"lazy"}));
+    auto lazy = Function::create("lazy", i64).set_body_producer([&m, i64] {
+        return Vec<BasicBlock>{BasicBlock::create("entry")
+                .add_instruction(Instruction::from(m.call_intrinsic(Intrinsic::Ctpop(i64), {Constant::Integer(3)})).set_name("c"))
+                .add_instruction(Instruction::from(Instruction::Ret(i64, Constant::LocalVariable("c"))))};
+    });
+    lazy.linkage = Linkage::Internal;
+    m.add_function(lazy);
+    m.prune();
+
+    CHECK(has_function(m, "lazy"));
+    CHECK(has_declaration(m, "llvm.ctpop.i64"));
+    CHECK(m.declared_intrinsics.contains("llvm.ctpop.i64"));
+}
+
+// A producer that defines what it calls can't be scanned correctly.
+static void producer_adds_function() {
+    Module m;
+    auto lazy = Function::create("main", *Type::Integer()).set_body_producer([&m] {
+        m.functions.push_back(function("late", Linkage::Internal, {}));
+        return Vec<BasicBlock>{BasicBlock::create("entry")
+                .add_instruction(Instruction::from(Instruction::Call(*Type::Integer(), "late")))
+                .add_instruction(Instruction::from(Instruction::Ret(*Type::Integer(), Constant::Integer(0))))};
+    });
+    m.add_function(lazy);
+    m.prune();
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "producer-adds-function") {
+        producer_adds_function();
+        return 0;
+    }
+    reachability();
+    producer_declarations();
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include <cstdlib>
+#include <new>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include "llvm.hpp"
+#include "check.hpp"
+using namespace LLVM;
+
+// Live and peak counts of global allocations.
+static long live = 0, peak = 0;
+
+void *operator new(std::size_t size) {
+    void *p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    if (++live > peak) peak = live;
+    return p;
+}
+void operator delete(void *p) noexcept {
+    if (!p) return;
+    live--;
+    std::free(p);
+}
+void operator delete(void *p, std::size_t) noexcept { operator delete(p); }
+
+struct NullBuffer : std::streambuf {
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+};
+
+static const usz calls_per_function = 200;
+
+// Returns {allocations left behind, peak allocations above the start} for
+// streaming a module of `n` lazy functions.
+static std::pair<long, long> stream_lazy_functions(usz n) {
+    auto i64 = *Type::Integer(64);
+    Module module;
+    for (usz k = 0; k < n; k++)
+        module.add_function(Function::create("f" + std::to_string(k), i64)
+            .add_parameter({i64, std::string("n")})
+            .set_body_producer([&module] {
+                auto i64 = *Type::Integer(64);
+                auto bb = BasicBlock::create("entry");
+                for (usz i = 0; i < calls_per_function; i++)
+                    bb.add_instruction(Instruction::from(Instruction::Call(*Type::Integer(64), "g")
+                        ->add_argument({*Type::Pointer(Type::Integer(8)), Constant::String("payload")})
+                        ->add_argument({i64, Constant::LocalVariable("n")})));
+                bb.add_instruction(Instruction::from(
+                    module.call_intrinsic(Intrinsic::Ctpop(*Type::Integer(64)), {Constant::LocalVariable("n")})).set_name("c"));
+                bb.add_instruction(Instruction::from(Instruction::Ret(i64, Constant::LocalVariable("c"))));
+                return Vec<BasicBlock>{bb};
+            }));
+
+    NullBuffer buffer;
+    std::ostream os(&buffer);
+    long before = live;
+    peak = live;
+    module.stream(os);
+    return {live - before, peak - before};
+}
+
+int main() {
+    auto [small_left, small_peak] = stream_lazy_functions(10);
+    auto [large_left, large_peak] = stream_lazy_functions(100);
+
+    // Nothing a produced body allocated outlives it, apart from the one-off
+    // intrinsic declaration and the metadata of the first call.
+    CHECK(large_left == small_left);
+    CHECK(small_left < 64);
+    // Peak is set by one function, not by how many there are.
+    CHECK(large_peak <= small_peak + 64);
+    CHECK(large_peak < static_cast<long>(calls_per_function) * 20);
+    return 0;
+}